@@ -2,9 +2,15 @@ var crypto = require('crypto'),
   http = require('http'),
   url = require('url'),
   fs = require('fs'),
+  os = require('os'),
+  path = require('path'),
+  util = require('util'),
+  Transform = require('stream').Transform,
   EventEmitter = require('events').EventEmitter;
 
-var TimeSignature = require('bindings')('timesignature.node').TimeSignature;
+var binding = require('bindings')('timesignature.node'),
+  TimeSignature = binding.TimeSignature,
+  PublicationsFile = binding.PublicationsFile;
 
 var pubok = new EventEmitter();
 pubok.setMaxListeners(0);
@@ -18,15 +24,450 @@ TimeSignature.prototype.valueOf = function valueOf() {
   return this.getContent().toString();
 };
 
+// without a callback the asynchronous methods return a Promise, where available
+function promising(obj, name) {
+  var fn = obj[name];
+  obj[name] = function () {
+    if (typeof(arguments[arguments.length - 1]) === 'function' || typeof(Promise) !== 'function')
+      return fn.apply(this, arguments);
+    var self = this, args = Array.prototype.slice.call(arguments);
+    return new Promise(function (resolve, reject) {
+      args.push(function (err, result) {
+        if (err)
+          reject(err);
+        else
+          resolve(result);
+      });
+      fn.apply(self, args);
+    });
+  };
+}
+['verifyAsync', 'compareHashAsync', 'checkPublicationAsync', 'extendAsync'].forEach(function (name) {
+  promising(TimeSignature.prototype, name);
+});
+['processResponseAsync', 'fromResponseAsync', 'verifyPublicationsAsync'].forEach(function (name) {
+  promising(TimeSignature, name);
+});
+
+function publicationsfresh() {
+  return GuardTime.publications.file &&
+      GuardTime.publications.updatedat + GuardTime.publications.lifetime * 1000 >= Date.now();
+}
+
+// downloads publications file once for any number of waiting callers
+function refreshpublications(callback) {
+  pubok.once('pubOK', callback);
+  if (pubok.listeners('pubOK').length <= 1)
+    GuardTime.loadPublications( function(err){
+      if (err)
+        refreshfailedat = Date.now();
+      pubok.emit('pubOK', err);
+    });
+}
+
+// seconds between background attempts if the publications service fails
+var REFRESH_RETRY = 60;
+// ms, longer timer delays overflow and fire at once
+var MAX_TIMER_DELAY = 0x7fffffff;
+var refreshtimer = null, refreshfailedat = 0;
+
+// refresh is started ahead of expiry so that verification never waits
+function schedulerefresh() {
+  clearTimeout(refreshtimer);
+  var due = GuardTime.publications.updatedat + GuardTime.publications.lifetime * 900;
+  refreshtimer = setTimeout(function () {
+    if (Date.now() < due)
+      return schedulerefresh();
+    refreshpublications(function () {});
+  }, Math.min(MAX_TIMER_DELAY, Math.max(0, due - Date.now())));
+  if (refreshtimer.unref)
+    refreshtimer.unref();
+}
+
+// verification can go on with a stale publications file, a new one is
+// downloaded in the background and swapped in when verified; past maxage
+// the refresh is waited for
+function publicationsready() {
+  if (!GuardTime.publications.file)
+    return false;
+  var maxage = GuardTime.publications.maxage;
+  if (maxage && GuardTime.publications.updatedat + maxage * 1000 < Date.now())
+    return false;
+  if (!publicationsfresh() && refreshfailedat + REFRESH_RETRY * 1000 < Date.now())
+    refreshpublications(function () {});
+  return true;
+}
+
+// if there is no publications file yet - download once and run 'next'
+function whenpublications(callback, next) {
+  refreshpublications(function(err){
+    if (err)
+      callback(err);
+    else
+      next();
+  });
+}
+
+// signHash() calls by algorithm and digest: in flight, and recently signed.
+// Tokens are kept encoded, every caller gets a TimeSignature of its own.
+var signings = { pending: {}, cache: {} };
+
+function remembersigning(key, der) {
+  var entry = signings.cache[key] = { der: der, expires: Date.now() + GuardTime.signing.cachetime };
+  var timer = setTimeout(function () {
+    if (signings.cache[key] === entry)
+      delete signings.cache[key];
+  }, GuardTime.signing.cachetime);
+  if (timer.unref)
+    timer.unref();
+}
+
+// pending aggregation rounds by hash algorithm
+var rounds = {};
+
+// signs the root of the round's hashes, each caller gets the token, as a
+// TimeSignature of its own, and its chain
+function signround(alg) {
+  var round = rounds[alg];
+  delete rounds[alg];
+  clearTimeout(round.timer);
+  var tree;
+  try {
+    tree = TimeSignature.aggregate(Buffer.concat(round.hashes), alg);
+  } catch (err) {
+    return round.callbacks.forEach(function (cb) { cb(err); });
+  }
+  GuardTime.signHash(tree.root, alg, function (err, ts) {
+    if (err)
+      return round.callbacks.forEach(function (cb) { cb(err); });
+    var der = round.callbacks.length > 1 && ts.getContent();
+    round.callbacks.forEach(function (cb, i) {
+      var own;
+      try {
+        own = i == 0 ? ts : new TimeSignature(der);
+      } catch (err) {
+        return cb(err);
+      }
+      cb(null, own, tree.chains[i]);
+    });
+  });
+}
+
+// Extension requests for tokens registered in the same second (and so sharing
+// the calendar history identifier) are identical, as are the responses: one
+// response extends all of them. In-flight requests are shared and responses
+// kept for extending further tokens locally once they have extended one,
+// until a newer publication makes the service extend to that one instead.
+var extensions = { pending: {}, cache: {}, order: [] };
+
+function lastpublication() {
+  return GuardTime.publications.last ? +GuardTime.publications.last : 0;
+}
+
+function extensionresponse(reqdata, callback) {
+  var key = reqdata.toString('hex'), cached = extensions.cache[key];
+  if (cached && cached.last < lastpublication())
+    forgetextension(key);
+  else if (cached)
+    return callback(null, cached.data, key);
+  if (extensions.pending[key])
+    return extensions.pending[key].push(callback);
+  var waiting = extensions.pending[key] = [callback];
+  servicerequest(GuardTime.service.verifier, reqdata, function (err, data) {
+    delete extensions.pending[key];
+    waiting.forEach(function (cb) { cb(err, data, key); });
+  });
+}
+
+function rememberextension(key, data) {
+  if (extensions.cache[key] || GuardTime.extension.cachesize <= 0)
+    return;
+  extensions.cache[key] = { data: data, last: lastpublication() };
+  extensions.order.push(key);
+  while (extensions.order.length > GuardTime.extension.cachesize)
+    delete extensions.cache[extensions.order.shift()];
+}
+
+// a response that did not extend the token, eg. 'try later', is not reused
+function forgetextension(key) {
+  if (extensions.cache[key]) {
+    delete extensions.cache[key];
+    extensions.order.splice(extensions.order.indexOf(key), 1);
+  }
+}
+
+// ts.verifyDocument() or ts.verifyAggregated(), extending the token first
+// if a publication exists for it
+function verifyagainstpublications(ts, method, args, callback) {
+  var done = function (err, properties) {
+    if (err)
+      return callback(err);
+    callback(null, properties.verification_status, properties);
+  };
+  try {
+    ts[method].apply(ts, args.concat(GuardTime.publications.file, function (err, properties, extend) {
+      if (err || !extend)
+        return done(err, properties);
+      GuardTime.extend(ts, function(err) {
+        //no failover:
+        // if (err) return callback(err);
+        //with failover: publication check is done without extending
+        try {
+          ts[method].apply(ts, args.concat(GuardTime.publications.file, true, done));
+        } catch (err) { return callback(err); }
+      });
+    }));
+  } catch (err) {
+    return callback(err);
+  }
+}
+
+// Publications file cache: the last verified file and a description of it
+// with the validators of the download and the SHA-256 of its contents.
+var pubcache = null; // description of the loaded file when caching
+
+function cachepaths() {
+  var dir = GuardTime.publications.cachedir;
+  return { data: path.join(dir, 'publications.bin'), info: path.join(dir, 'publications.json') };
+}
+
+// loads the cached file without verifying it again if its digest matches
+function loadcachedpublications(callback) {
+  var paths = cachepaths();
+  fs.readFile(paths.info, 'utf8', function (err, json) {
+    var info;
+    try {
+      info = JSON.parse(json);
+      if (!info || typeof(info.updatedat) !== 'number')
+        throw new Error("Bad publications cache description: " + paths.info);
+    } catch (e) {
+      return callback(err || e);
+    }
+    fs.readFile(paths.data, function (err, data) {
+      if (err)
+        return callback(err);
+      // anyone able to write the cache could have replaced the file, so its
+      // signature is verified as for a download
+      TimeSignature.verifyPublicationsAsync(data, function (err, d, pf) {
+        if (err)
+          return callback(err);
+        info.sha256 = crypto.createHash('sha256').update(data).digest('hex');
+        info.last = d.getTime();
+        pubcache = info;
+        GuardTime.publications.last = d;
+        GuardTime.publications.data = data;
+        GuardTime.publications.file = pf;
+        GuardTime.publications.updatedat = info.updatedat;
+        schedulerefresh();
+        callback(null);
+      });
+    });
+  });
+}
+
+// writes file contents and then its description, both replaced atomically
+function storepublications(data, info) {
+  var paths = cachepaths(), tmp = '.' + process.pid;
+  var replace = function (file, content, next) {
+    fs.writeFile(file + tmp, content, function (err) {
+      if (err)
+        return next(err);
+      fs.rename(file + tmp, file, next);
+    });
+  };
+  var describe = function (err) {
+    if (!err)
+      replace(paths.info, JSON.stringify(info), function () {});
+  };
+  if (data)
+    replace(paths.data, data, describe);
+  else
+    describe();
+}
+
+// Adaptive limit on the requests in flight to a service (AIMD): while the
+// limit is in use it grows by one per 'limit' requests answered in time, and
+// it is halved, at most once per round trip, on errors and on
+// answers much slower than the best seen lately. Requests over the limit
+// wait in a bounded queue; when the queue is full they fail at once.
+function Limiter(limit, max, queuelength) {
+  this.min = 1;                   // floor, a request is always let through
+  this.max = max;                 // ceiling, also the connection pool size
+  this.limit = Math.min(limit, max);
+  this.queuelength = queuelength;
+  this.inflight = 0;
+  this.queued = 0;                // requests waiting, same as queue.length
+  this.queue = [];
+  this.baseline = 0;              // ms, fastest recent answer
+  this.decreasedat = 0;
+}
+
+// answers slower than baseline * LIMITER_TOLERANCE count as congestion
+var LIMITER_TOLERANCE = 2;
+
+Limiter.prototype.run = function (task, callback) {
+  if (this.inflight < Math.floor(this.limit))
+    return this.start(task, callback);
+  if (this.queue.length >= this.queuelength)
+    return callback(new Error("Service overloaded: " + this.queue.length + " requests queued"));
+  this.queue.push([task, callback]);
+  this.queued = this.queue.length;
+};
+
+Limiter.prototype.start = function (task, callback) {
+  var self = this, started = Date.now();
+  this.inflight++;
+  task(function (err) {
+    var busy = self.inflight >= Math.floor(self.limit);
+    self.inflight--;
+    self.adjust(err, Date.now() - started, busy);
+    callback.apply(null, arguments);
+    while (self.queue.length && self.inflight < Math.floor(self.limit)) {
+      var next = self.queue.shift();
+      self.queued = self.queue.length;
+      self.start(next[0], next[1]);
+    }
+  });
+};
+
+Limiter.prototype.adjust = function (err, latency, busy) {
+  if (!err) {
+    // the baseline follows faster answers at once and slower ones slowly
+    this.baseline = !this.baseline || latency < this.baseline ? latency :
+        this.baseline + (latency - this.baseline) / 100;
+  }
+  var now = Date.now();
+  if (err || latency > this.baseline * LIMITER_TOLERANCE) {
+    if (now - this.decreasedat > this.baseline) {
+      this.limit = Math.max(this.min, this.limit / 2);
+      this.decreasedat = now;
+    }
+  } else if (busy) {
+    this.limit = Math.min(this.max, this.limit + 1 / this.limit);
+  }
+};
+
+// Recent answer times of a service, for the hedging delay
+function Latencies(size) {
+  this.size = size;
+  this.samples = [];
+  this.pos = 0;
+}
+
+Latencies.prototype.add = function (ms) {
+  this.samples[this.pos] = ms;
+  this.pos = (this.pos + 1) % this.size;
+};
+
+Latencies.prototype.percentile = function (p) {
+  var sorted = this.samples.slice().sort(function (a, b) { return a - b; });
+  return sorted[Math.min(sorted.length - 1, Math.floor(sorted.length * p / 100))];
+};
+
+// answer times kept per service
+var LATENCY_SAMPLES = 200;
+
+// answer times needed before the percentile is used for hedging
+var HEDGE_MIN_SAMPLES = 20;
+
+// Request to one of the equivalent endpoints of a service, taken in turn.
+// If there is no answer within the hedging delay (the configured percentile
+// of recent answer times) or the request fails, it is sent to the next
+// endpoint as well; the first answer wins. No answer within the request
+// timeout is an error.
+function hedgedrequest(service, what, callback) {
+  var endpoints = service.endpoints || [service],
+    first = service.next = ((service.next || 0) + 1) % endpoints.length,
+    sent = 0, pending = 0, requests = [], finished = false,
+    started = Date.now(), hedgetimer = null, deadline = null;
+
+  var finish = function (err, data, res) {
+    finished = true;
+    clearTimeout(hedgetimer);
+    clearTimeout(deadline);
+    requests.forEach(function (req) { req.abort(); });
+    if (!err)
+      service.latency.add(Date.now() - started);
+    callback(err, data, res);
+  };
+  var attempt = function () {
+    var req, where = endpoints[(first + sent++) % endpoints.length];
+    pending++;
+    req = dorequest(where, what, function (err, data, res) {
+      pending--;
+      if (finished)
+        return;
+      requests.splice(requests.indexOf(req), 1);
+      if (err && sent < endpoints.length) {
+        clearTimeout(hedgetimer);
+        return attempt();
+      }
+      if (err && pending > 0)
+        return;
+      finish(err, data, res);
+    });
+    requests.push(req);
+    if (sent < endpoints.length && GuardTime.hedging.percentile > 0) {
+      var delay = service.latency.samples.length >= HEDGE_MIN_SAMPLES ?
+          service.latency.percentile(GuardTime.hedging.percentile) : GuardTime.hedging.delay;
+      clearTimeout(hedgetimer);
+      hedgetimer = setTimeout(attempt, delay);
+    }
+  };
+  if (GuardTime.hedging.timeout > 0)
+    deadline = setTimeout(function () {
+      finish(new Error("Service '" + service.href + "' error: no answer in "
+          + GuardTime.hedging.timeout + " ms"));
+    }, GuardTime.hedging.timeout);
+  attempt();
+}
+
+function setendpoints(service, uris) {
+  uris = [].concat(uris);
+  addprops(service, url.parse(uris[0]));
+  service.endpoints = uris.map(function (uri, i) {
+    return i ? addprops(url.parse(uri), { method: service.method, agent: service.agent }) : service;
+  });
+}
+
+// request to the signing or extending service, within its adaptive limit
+function servicerequest(where, what, callback) {
+  where.limiter.run(function (done) {
+    hedgedrequest(where, what, done);
+  }, callback);
+}
+
+function setlimit(service, threads, max) {
+  var limiter = service.limiter;
+  if (max) {
+    limiter.max = max;
+    service.agent.maxSockets = max;
+  }
+  if (threads)
+    limiter.limit = threads;
+  limiter.limit = Math.min(limiter.limit, limiter.max);
+}
+
 var defaultconf = {
   signeruri:       'http://stamper.guardtime.net/gt-signingservice',
   verifieruri:     'http://verifier.guardtime.net/gt-extendingservice',
   publicationsuri: 'http://verify.guardtime.com/gt-controlpublications.bin',
-  signerthreads:       16,
-  verifierthreads:     2,
+  signerthreads:       64, // max., requests in flight are limited adaptively
+  verifierthreads:     8,
   publicationsthreads: 1,
+  signerlimit:   16,       // initial adaptive limits
+  verifierlimit: 2,
+  queuelength:   1000,     // requests waiting for the limit, per service
+  hedgepercentile: 95,     // of answer times, delay before asking another endpoint
+  hedgedelay:    1000,     // ms, delay until enough answer times are known
+  requesttimeout: 0,       // ms, no timeout if 0
   publicationsdata: '',
-  publicationslifetime: 60*60*7
+  publicationslifetime: 60*60*7,
+  publicationsmaxage: 60*60*24*7,
+  aggregationwindow: 50,
+  aggregationmax: 4096,
+  extensioncachesize: 1000,
+  signcachetime: 0
 };
 
 function addprops(a, p){
@@ -37,12 +478,20 @@ function addprops(a, p){
   return a;
 }
 
+// larger announced lengths are not trusted with an allocation up front
+var MAX_PREALLOCATED_RESPONSE = 16 * 1024 * 1024;
+
 function dorequest(where, what, inloop){
   var callback = arguments[arguments.length - 1];
     if (typeof(callback) !== 'function')
       callback = function (){};
-  where.headers = {'Content-Length': what.length};
+  where.headers = addprops({'Content-Length': what.length}, where.conditional);
   var req = http.request(where, function(res) {
+    // conditional request: the data is unchanged, callback gets null
+    if (res.statusCode == 304 && where.conditional) {
+      res.resume();
+      return callback(null, null, res);
+    }
     if (res.statusCode >= 301 && res.statusCode <= 307 ) {
       var elsewhere = addprops(where, url.parse(res.headers.location));
       res.destroy();
@@ -58,12 +507,26 @@ function dorequest(where, what, inloop){
           + "' error: " + res.statusCode
           + " (" + http.STATUS_CODES[res.statusCode] + ")"));
     }
-    var data = "";
+    // response is passed on as a Buffer; with a known length it is
+    // assembled in place, otherwise the chunks are joined once at the end
+    var length = parseInt(res.headers['content-length'], 10),
+      data = length >= 0 && length <= MAX_PREALLOCATED_RESPONSE ? new Buffer(length) : null,
+      filled = 0, chunks = [], received = 0;
     res.on('data', function (chunk) {
-      data += chunk.toString('binary');
+      if (data && !chunks.length && filled + chunk.length <= length) {
+        chunk.copy(data, filled);
+        filled += chunk.length;
+      } else {
+        chunks.push(chunk);
+      }
+      received += chunk.length;
     });
     res.on('end', function(){
-      callback(null, data);
+      if (!data)
+        data = Buffer.concat(chunks, received);
+      else if (filled !== received || filled !== length)  // server got the length wrong
+        data = Buffer.concat([data.slice(0, filled)].concat(chunks), received);
+      callback(null, data, res);
     });
   });
   req.on('error', function(e) {
@@ -72,8 +535,326 @@ function dorequest(where, what, inloop){
   });
   req.write(what);
   req.end();
+  return req;
+}
+
+
+// Passes data through unchanged while hashing it; once all data is written
+// the hash is signed and the token emitted as 'signature' before 'end'.
+// With options.passthrough false nothing is passed on, for use as a Writable.
+function SigningStream(options) {
+  Transform.call(this, options);
+  this.algorithm = (options && options.algorithm) || GuardTime.default_hashalg;
+  this.passthrough = !options || options.passthrough !== false;
+  this.hash = crypto.createHash(this.algorithm);
+  this.signature = null;
+  if (!this.passthrough)
+    this.resume();
+}
+util.inherits(SigningStream, Transform);
+
+SigningStream.prototype._transform = function (chunk, encoding, callback) {
+  this.hash.update(chunk);
+  callback(null, this.passthrough ? chunk : null);
+};
+
+SigningStream.prototype._flush = function (callback) {
+  var self = this;
+  GuardTime.signHash(this.hash.digest(), this.algorithm, function (err, ts) {
+    if (err)
+      return callback(err);
+    self.signature = ts;
+    self.emit('signature', ts);
+    callback();
+  });
+};
+
+// Runs at most 'concurrency' tasks at a time, the others wait in order.
+function Stage(concurrency) {
+  this.concurrency = concurrency;
+  this.active = 0;
+  this.queue = [];
+}
+
+Stage.prototype.push = function (task) {
+  this.queue.push(task);
+  this.pump();
+};
+
+Stage.prototype.pump = function () {
+  var self = this;
+  while (this.active < this.concurrency && this.queue.length) {
+    this.active++;
+    this.queue.shift()(function () {
+      self.active--;
+      self.pump();
+    });
+  }
+};
+
+Stage.prototype.busy = function () {
+  return this.active + this.queue.length >= this.concurrency;
+};
+
+// Bulk verification of (file, token) pairs taken from 'items' as needed:
+// files are hashed, tokens verified and extended if needed in three stages
+// with separate concurrency limits. Emits 'result' per item, 'progress'
+// with stats() every options.interval ms and 'end' with the summary.
+// With options.checkpoint the items with a verification outcome are recorded
+// in that file, and a new run over the same items skips them; items that
+// could not be read are tried again.
+function VerifyEngine(items, options) {
+  EventEmitter.call(this);
+  options = options || {};
+  this.iterator = Array.isArray(items) ? arrayiterator(items) :
+      typeof(items.next) === 'function' ? items :
+      typeof(Symbol) === 'function' && items[Symbol.iterator] ? items[Symbol.iterator]() :
+      null;
+  if (!this.iterator)
+    throw new TypeError("Items must be an Array or an iterator");
+  this.hashing = new Stage(options.hashing || 4);
+  this.verifying = new Stage(options.verifying || os.cpus().length);
+  this.extending = new Stage(options.extending || GuardTime.service.verifier.limiter.max);
+  this.window = options.window || 256;  // items in the stages at once
+  this.interval = options.interval || 1000;
+  this.checkpoint = options.checkpoint;
+  this.mark = 0;      // items before this are all done
+  this.done = {};     // items done after the mark
+  this.count = 0;
+  this.pulled = 0;    // items taken from the iterator
+  this.seen = '';     // hash chain over the items taken, for the checkpoint
+  this.ahead = [];    // items taken but not yet counted
+  this.inflight = 0;
+  this.exhausted = false;
+  this.totals = { verified: 0, failed: 0, skipped: 0 };
+  this.started = 0;
+  this.timer = null;
+}
+util.inherits(VerifyEngine, EventEmitter);
+
+// link of the hash chain identifying the items of a checkpointed run
+function chainitem(seen, item) {
+  var key = typeof(item) === 'string' ? [item] :
+      [item.file, typeof(item.token) === 'string' ? item.token : null];
+  return crypto.createHash('sha256').update(seen + JSON.stringify(key)).digest('hex');
+}
+
+function arrayiterator(array) {
+  var i = 0;
+  return { next: function () {
+    return i < array.length ? { value: array[i++], done: false } : { done: true };
+  } };
 }
 
+VerifyEngine.prototype.start = function () {
+  var self = this;
+  this.started = Date.now();
+  var run = function () {
+    self.timer = setInterval(function () {
+      self.save();
+      self.emit('progress', self.stats());
+    }, self.interval);
+    if (self.timer.unref)
+      self.timer.unref();
+    self.pull();
+  };
+  var resume = function () {
+    if (!self.checkpoint)
+      return run();
+    fs.readFile(self.checkpoint, 'utf8', function (err, json) {
+      var saved;
+      try {
+        saved = JSON.parse(json);
+      } catch (e) {
+        // no usable checkpoint, start from the beginning
+        return run();
+      }
+      // the checkpoint applies only if the same items come first now
+      while (self.pulled < saved.items) {
+        var next = self.take();
+        if (next.done)
+          break;
+        self.ahead.push(next);
+      }
+      if (self.pulled === saved.items && self.seen === saved.seen) {
+        self.mark = saved.mark;
+        saved.done.forEach(function (i) { self.done[i] = true; });
+      }
+      run();
+    });
+  };
+  if (publicationsready())
+    return resume();
+  whenpublications(function (err) { self.finish(err); }, resume);
+};
+
+VerifyEngine.prototype.stats = function () {
+  var elapsed = (Date.now() - this.started) / 1000,
+    completed = this.totals.verified + this.totals.failed;
+  return {
+    verified: this.totals.verified,
+    failed: this.totals.failed,
+    skipped: this.totals.skipped,
+    rate: elapsed > 0 ? completed / elapsed : 0, // items per second
+    queues: {
+      hashing: this.hashing.queue.length,
+      verifying: this.verifying.queue.length,
+      extending: this.extending.queue.length
+    },
+    active: {
+      hashing: this.hashing.active,
+      verifying: this.verifying.active,
+      extending: this.extending.active
+    }
+  };
+};
+
+VerifyEngine.prototype.take = function () {
+  var next = this.iterator.next();
+  if (!next.done) {
+    this.pulled++;
+    this.seen = chainitem(this.seen, next.value);
+  }
+  return next;
+};
+
+VerifyEngine.prototype.pull = function () {
+  while (!this.exhausted && this.inflight < this.window && !this.hashing.busy()) {
+    var next = this.ahead.length ? this.ahead.shift() : this.take();
+    if (next.done) {
+      this.exhausted = true;
+      break;
+    }
+    var index = this.count++;
+    if (index < this.mark || this.done[index]) {
+      this.totals.skipped++;
+      continue;
+    }
+    this.inflight++;
+    this.process(index, next.value);
+  }
+  if (this.exhausted && this.inflight === 0)
+    this.finish(null);
+};
+
+// item: file name (token in file + '.gtts') or {file, token}, token being
+// a TimeSignature, its content or the name of a file containing it
+VerifyEngine.prototype.process = function (index, item) {
+  var self = this,
+    file = typeof(item) === 'string' ? item : item.file,
+    token = typeof(item) === 'string' ? item + '.gtts' : item.token,
+    result = { index: index, file: file };
+  // retry: no verification outcome, the item is not checkpointed
+  var complete = function (err, properties, retry) {
+    result.error = err || null;
+    result.properties = properties;
+    result.status = properties ? properties.verification_status : undefined;
+    self.totals[err ? 'failed' : 'verified']++;
+    self.inflight--;
+    if (!retry)
+      self.record(index);
+    self.emit('result', result);
+    self.pull();
+  };
+  var verified = function (ts, hash, alg) {
+    return function (release) {
+      try {
+        ts.verifyDocument(hash, alg, GuardTime.publications.file, extended);
+      } catch (err) {
+        release();
+        complete(err);
+      }
+      function extended(err, properties, extend) {
+        release();
+        if (err || !extend)
+          return complete(err, properties);
+        self.extending.push(function (release) {
+          GuardTime.extend(ts, function () {
+            // with failover, as in verifyHash()
+            try {
+              ts.verifyDocument(hash, alg, GuardTime.publications.file, true, function (err, properties) {
+                release();
+                complete(err, properties);
+              });
+            } catch (err) {
+              release();
+              complete(err);
+            }
+          });
+        });
+      }
+    };
+  };
+  this.hashing.push(function (release) {
+    var fail = function (err, retry) {
+      release();
+      complete(err, undefined, retry);
+    };
+    var hashed = function (ts) {
+      var alg = ts.getHashAlgorithm();
+      result.token = ts;
+      TimeSignature.hashFile(file, alg, function (err, hash) {
+        if (err)
+          return fail(err, true);
+        release();
+        self.verifying.push(verified(ts, hash, alg));
+        // the hashing stage has room for the next item
+        self.pull();
+      });
+    };
+    try {
+      if (token instanceof TimeSignature)
+        return hashed(token);
+      if (typeof(token) !== 'string')
+        return hashed(new TimeSignature(token));
+      fs.readFile(token, function (err, data) {
+        if (err)
+          return fail(err, true);
+        try {
+          hashed(new TimeSignature(data));
+        } catch (err) {
+          fail(err);
+        }
+      });
+    } catch (err) {
+      fail(err);
+    }
+  });
+};
+
+VerifyEngine.prototype.record = function (index) {
+  this.done[index] = true;
+  while (this.done[this.mark]) {
+    delete this.done[this.mark];
+    this.mark++;
+  }
+};
+
+VerifyEngine.prototype.save = function (callback) {
+  callback = callback || function () {};
+  if (!this.checkpoint)
+    return callback();
+  var tmp = this.checkpoint + '.' + process.pid, file = this.checkpoint;
+  fs.writeFile(tmp, JSON.stringify({ items: this.pulled, seen: this.seen,
+      mark: this.mark, done: Object.keys(this.done).map(Number) }), function (err) {
+    if (err)
+      return callback(err);
+    fs.rename(tmp, file, callback);
+  });
+};
+
+VerifyEngine.prototype.finish = function (err) {
+  var self = this;
+  if (this.finished)
+    return;
+  this.finished = true;
+  clearInterval(this.timer);
+  this.save(function () {
+    var summary = self.stats();
+    summary.elapsed = Date.now() - self.started;
+    self.emit('end', err, summary);
+  });
+};
 
 var GuardTime = module.exports = {
   default_hashalg: 'SHA256',
@@ -84,23 +865,49 @@ var GuardTime = module.exports = {
     PUBLICATION_CHECKED : 32
   },
   TimeSignature: TimeSignature,
+  PublicationsFile: PublicationsFile,
+  SigningStream: SigningStream,
   publications: {
     data: '',
+    file: null, // decoded data, a PublicationsFile
     last: '',
     updatedat: 0,
-    lifetime: 60*60*7
+    lifetime: 60*60*7,
+    maxage: defaultconf.publicationsmaxage, // s, a staler file is not used
+    cachedir: null // directory keeping the last verified file across restarts
+  },
+  aggregation: {
+    window: defaultconf.aggregationwindow, // ms to collect hashes for a round
+    max: defaultconf.aggregationmax        // round is signed at once when full
+  },
+  signing: {
+    cachetime: defaultconf.signcachetime // ms a token is reused for the same hash
+  },
+  hedging: {
+    percentile: defaultconf.hedgepercentile,
+    delay: defaultconf.hedgedelay,
+    timeout: defaultconf.requesttimeout
+  },
+  extension: {
+    cachesize: defaultconf.extensioncachesize // extension responses kept for reuse
   },
 
   service: {
     signer: addprops(url.parse(defaultconf.signeruri),
                   { method: 'POST',
                     agent: addprops(new http.Agent(),
-                                    { maxSockets: defaultconf.signerthreads })
+                                    { maxSockets: defaultconf.signerthreads }),
+                    limiter: new Limiter(defaultconf.signerlimit, defaultconf.signerthreads,
+                                         defaultconf.queuelength),
+                    latency: new Latencies(LATENCY_SAMPLES)
                   }),
     verifier: addprops(url.parse(defaultconf.verifieruri),
                   { method: 'POST',
                     agent: addprops(new http.Agent(),
-                                   { maxSockets: defaultconf.verifierthreads })
+                                   { maxSockets: defaultconf.verifierthreads }),
+                    limiter: new Limiter(defaultconf.verifierlimit, defaultconf.verifierthreads,
+                                         defaultconf.queuelength),
+                    latency: new Latencies(LATENCY_SAMPLES)
                   }),
     publications: addprops(url.parse(defaultconf.publicationsuri),
                   { method: 'GET',
@@ -111,28 +918,80 @@ var GuardTime = module.exports = {
 
   conf: function (options) {  // prettify me!
     if (options.signeruri)
-      addprops(GuardTime.service.signer, url.parse(options.signeruri));
-    if (options.signerthreads)
-      GuardTime.service.signer.agent.maxSockets = options.signerthreads;
+      setendpoints(GuardTime.service.signer, options.signeruri);
+    if (options.signerthreads || options.signerlimit)
+      setlimit(GuardTime.service.signer, options.signerlimit, options.signerthreads);
     if (options.verifieruri)
-      addprops(GuardTime.service.verifier, url.parse(options.verifieruri));
-    if (options.verifierthreads)
-      GuardTime.service.verifier.agent.maxSockets = options.verifierthreads;
+      setendpoints(GuardTime.service.verifier, options.verifieruri);
+    if (options.verifierthreads || options.verifierlimit)
+      setlimit(GuardTime.service.verifier, options.verifierlimit, options.verifierthreads);
+    if (options.signcachetime !== undefined) {
+      if (! isFinite(options.signcachetime) || options.signcachetime < 0)
+          throw new Error("Signing cache time must be a non-negative number.");
+      GuardTime.signing.cachetime = options.signcachetime;
+    }
+    if (options.hedgepercentile !== undefined) {
+      if (! isFinite(options.hedgepercentile) || options.hedgepercentile < 0 || options.hedgepercentile > 100)
+          throw new Error("Hedging percentile must be a number from 0 to 100.");
+      GuardTime.hedging.percentile = options.hedgepercentile;
+    }
+    if (options.hedgedelay !== undefined)
+      GuardTime.hedging.delay = options.hedgedelay;
+    if (options.requesttimeout !== undefined) {
+      if (! isFinite(options.requesttimeout) || options.requesttimeout < 0)
+          throw new Error("Request timeout must be a non-negative number.");
+      GuardTime.hedging.timeout = options.requesttimeout;
+    }
+    if (options.queuelength !== undefined) {
+      if (! isFinite(options.queuelength) || options.queuelength < 0)
+          throw new Error("Queue length must be a non-negative number.");
+      GuardTime.service.signer.limiter.queuelength = options.queuelength;
+      GuardTime.service.verifier.limiter.queuelength = options.queuelength;
+    }
     if (options.publicationsuri)
       addprops(GuardTime.service.publications, url.parse(options.publicationsuri));
     if (options.publicationsthreads)
       GuardTime.service.publications.agent.maxSockets = options.publicationsthreads;
     if (options.publicationsdata) {
-      var d = TimeSignature.verifyPublications(options.publicationsdata); // exception on error
-      GuardTime.publications.last = d; // last publication datum
+      var pf = new PublicationsFile(options.publicationsdata); // exception on error
+      GuardTime.publications.last = pf.getLastPublicationTime(); // last publication datum
       GuardTime.publications.data = options.publicationsdata;
+      GuardTime.publications.file = pf;
       GuardTime.publications.updatedat = Date.now();
     }
+    if (options.publicationscache !== undefined) {
+      GuardTime.publications.cachedir = options.publicationscache;
+      pubcache = null;
+    }
     if (options.publicationslifetime) {
       if (! isFinite(options.publicationslifetime) || options.publicationslifetime <= 0)
           throw new Error("Publications data lifetime must be a positive number.");
       GuardTime.publications.lifetime = options.publicationslifetime;
     }
+    if (options.publicationsmaxage !== undefined) {
+      if (! isFinite(options.publicationsmaxage) || options.publicationsmaxage < 0)
+          throw new Error("Publications data max. age must be a non-negative number.");
+      GuardTime.publications.maxage = options.publicationsmaxage;
+    }
+    if (GuardTime.publications.file && (options.publicationsdata || options.publicationslifetime))
+      schedulerefresh();
+    if (options.aggregationwindow !== undefined) {
+      if (! isFinite(options.aggregationwindow) || options.aggregationwindow < 0)
+          throw new Error("Aggregation window must be a non-negative number.");
+      GuardTime.aggregation.window = options.aggregationwindow;
+    }
+    if (options.aggregationmax !== undefined) {
+      if (! isFinite(options.aggregationmax) || options.aggregationmax < 1)
+          throw new Error("Aggregation round size must be a positive number.");
+      GuardTime.aggregation.max = options.aggregationmax;
+    }
+    if (options.extensioncachesize !== undefined) {
+      if (! isFinite(options.extensioncachesize) || options.extensioncachesize < 0)
+          throw new Error("Extension cache size must be a non-negative number.");
+      GuardTime.extension.cachesize = options.extensioncachesize;
+      while (extensions.order.length > options.extensioncachesize)
+        delete extensions.cache[extensions.order.shift()];
+    }
   },
 
   sign: function (data, callback) {
@@ -146,21 +1005,34 @@ var GuardTime = module.exports = {
     GuardTime.signHash(hash.digest(), GuardTime.default_hashalg, callback);
   },
 
+  // stream signing the data piped through it; callback(err, token) is optional
+  createSigningStream: function (options, callback) {
+    if (typeof(options) === 'function') {
+      callback = options;
+      options = {};
+    }
+    var stream = new SigningStream(options);
+    if (callback) {
+      stream.once('signature', function (ts) { callback(null, ts); });
+      stream.once('error', callback);
+    }
+    return stream;
+  },
+
   signFile: function (filename, callback) {
-    var hash, rs;
     try {
-      hash = crypto.createHash(GuardTime.default_hashalg);
-      fs.createReadStream(filename, {'bufferSize': 128*1024})
-        .on('data', function(chunk) { hash.update(chunk); })
-        .on('error', callback)
-        .on('end', function() {
-          GuardTime.signHash(hash.digest(), GuardTime.default_hashalg, callback);
+      TimeSignature.hashFile(filename, GuardTime.default_hashalg, function (err, digest) {
+        if (err)
+          return callback(err);
+        GuardTime.signHash(digest, GuardTime.default_hashalg, callback);
       });
     } catch (err) {
       return callback(err);
     }
   },
 
+  // callers signing the same hash meanwhile, or within signcachetime, get
+  // the same token
   signHash: function (hash, alg) {
     var callback = arguments[arguments.length - 1];
     if (typeof(callback) !== 'function')
@@ -172,18 +1044,77 @@ var GuardTime = module.exports = {
       return callback(err);
     }
 
-    dorequest(GuardTime.service.signer, reqdata, function(err, data){
+    // the request encodes just the algorithm and digest
+    var key = reqdata.toString('hex');
+    var cached = signings.cache[key];
+    if (cached && cached.expires > Date.now())
+      return process.nextTick(function () {
+        var ts;
+        try {
+          ts = new TimeSignature(cached.der);
+        } catch (err) {
+          return callback(err);
+        }
+        callback(null, ts);
+      });
+    if (signings.pending[key])
+      return signings.pending[key].push(callback);
+    var waiting = signings.pending[key] = [callback];
+    var done = function (err, ts) {
+      delete signings.pending[key];
+      if (err)
+        return waiting.forEach(function (cb) { cb(err); });
+      var der = (waiting.length > 1 || GuardTime.signing.cachetime > 0) && ts.getContent();
+      if (GuardTime.signing.cachetime > 0)
+        remembersigning(key, der);
+      waiting.forEach(function (cb, i) {
+        var own;
+        try {
+          own = i == 0 ? ts : new TimeSignature(der);
+        } catch (err) {
+          return cb(err);
+        }
+        cb(null, own);
+      });
+    };
+
+    servicerequest(GuardTime.service.signer, reqdata, function(err, data){
       if (err)
-        return callback(err);
+        return done(err);
       try {
-        var ts = new TimeSignature(TimeSignature.processResponse(data));
-        callback(null, ts);
+        TimeSignature.fromResponseAsync(data, done);
       } catch (err) {
-        return callback(err);
+        return done(err);
       }
     });
   },
 
+  // hashes signed within the aggregation window share one signing request;
+  // callback(err, ts, chain) where 'chain' links the hash to the signed root
+  signHashAggregated: function (hash, alg) {
+    var callback = arguments[arguments.length - 1];
+    if (typeof(callback) !== 'function')
+      callback = function (){};
+    var round = rounds[alg];
+    if (!round) {
+      try {
+        round = { size: crypto.createHash(alg).digest().length, hashes: [], callbacks: [] };
+      } catch (err) {
+        return callback(err);
+      }
+      round.timer = setTimeout(function () { signround(alg); }, GuardTime.aggregation.window);
+      rounds[alg] = round;
+    }
+    if (!Buffer.isBuffer(hash))
+      hash = new Buffer(hash, 'binary');
+    if (hash.length !== round.size)
+      return callback(new Error("Hash length does not match the algorithm " + alg));
+    round.hashes.push(hash);
+    round.callbacks.push(callback);
+    if (round.hashes.length >= GuardTime.aggregation.max)
+      signround(alg);
+  },
+
   save: function (filename, ts, cb) {
     try {
       fs.writeFile(filename, ts.getContent(), 'binary', cb);
@@ -211,18 +1142,60 @@ var GuardTime = module.exports = {
     if (typeof(callback) !== 'function')
       callback = function (){};
 
-    dorequest(GuardTime.service.publications, "", function(err, data){
+    var cachedir = GuardTime.publications.cachedir;
+    if (cachedir && !GuardTime.publications.file && !pubcache)
+      // warm start from the cache; a file that is still fresh needs no download
+      return loadcachedpublications(function (err) {
+        pubcache = pubcache || {};
+        if (!err && publicationsfresh())
+          return callback(null);
+        GuardTime.loadPublications(callback);
+      });
+
+    var where = GuardTime.service.publications;
+    if (cachedir && pubcache && pubcache.sha256 && GuardTime.publications.file &&
+        (pubcache.etag || pubcache.lastmodified)) {
+      // only the validators the server gave, headers can't be undefined
+      var conditional = {};
+      if (pubcache.etag)
+        conditional['If-None-Match'] = pubcache.etag;
+      if (pubcache.lastmodified)
+        conditional['If-Modified-Since'] = pubcache.lastmodified;
+      where = addprops(addprops({}, where), {conditional: conditional});
+    }
+    dorequest(where, "", function(err, data, res){
       if (err)
         return callback(err);
-      try {
-        var d = TimeSignature.verifyPublications(data); // exception on error
+      var sha256 = cachedir && data && crypto.createHash('sha256').update(data).digest('hex');
+      var revalidated = function () {
+        GuardTime.publications.updatedat = pubcache.updatedat = Date.now();
+        storepublications(null, pubcache);
+        schedulerefresh();
+        callback(null);
+      };
+      // same bytes as the verified file in use: no need to verify again
+      if (data === null || (sha256 && pubcache && pubcache.sha256 === sha256 && GuardTime.publications.file))
+        return revalidated();
+      TimeSignature.verifyPublicationsAsync(data, function (err, d, pf) {
+        if (err)
+          return callback(err);
         GuardTime.publications.last = d;
         GuardTime.publications.data = data;
+        GuardTime.publications.file = pf;
         GuardTime.publications.updatedat = Date.now();
-      } catch (err) {
-        return callback(err);
-      }
-      callback(null);
+        if (cachedir) {
+          pubcache = {
+            etag: res.headers.etag,
+            lastmodified: res.headers['last-modified'],
+            sha256: sha256,
+            last: d.getTime(),
+            updatedat: GuardTime.publications.updatedat
+          };
+          storepublications(data, pubcache);
+        }
+        schedulerefresh();
+        callback(null);
+      });
     });
   },
 
@@ -237,15 +1210,23 @@ var GuardTime = module.exports = {
     } catch (err) {
       return callback(err);
     }
-    dorequest(GuardTime.service.verifier, reqdata, function(err, data){
+    extensionresponse(reqdata, function(err, data, key){
       if (err)
         return callback(err);
-      try{
-        ts.extend(data);
+      try {
+        ts.extendAsync(data, function (err, result) {
+          if (err || result !== true) {
+            forgetextension(key);
+            if (err)
+              return callback(err);
+          } else {
+            rememberextension(key, data);
+          }
+          callback(null, ts);
+        });
       } catch (err) {
         return callback(err);
       }
-      callback(null, ts);
     });
   },
 
@@ -266,45 +1247,57 @@ var GuardTime = module.exports = {
     var callback = arguments[arguments.length - 1];
     if (typeof(callback) !== 'function')
       callback = function (){};
-    var properties = {};
-    // if publications file is not yet downloaded or data too old - download once and recall itself
-    if (!GuardTime.publications.data ||
-          (GuardTime.publications.updatedat + GuardTime.publications.lifetime * 1000 < Date.now())) {
-      pubok.once('pubOK', function(err){
-        if (err)
-          callback(err);
-        else
-          GuardTime.verifyHash(hash, alg, ts, callback);
+    if (!publicationsready())
+      return whenpublications(callback, function () {
+        GuardTime.verifyHash(hash, alg, ts, callback);
+      });
+    verifyagainstpublications(ts, 'verifyDocument', [hash, alg], callback);
+  },
+
+  // hash signed with signHashAggregated(), 'chain' as returned with the token
+  verifyAggregated: function(hash, alg, ts, chain) {
+    var callback = arguments[arguments.length - 1];
+    if (typeof(callback) !== 'function')
+      callback = function (){};
+    if (!publicationsready())
+      return whenpublications(callback, function () {
+        GuardTime.verifyAggregated(hash, alg, ts, chain, callback);
+      });
+    verifyagainstpublications(ts, 'verifyAggregated', [hash, alg, chain], callback);
+  },
+
+  // tokens: Array of TimeSignatures or serialized tokens, or a Buffer of concatenated tokens;
+  // hashes: Array of digests, or a Buffer of equally sized digests
+  verifyBatch: function(tokens, hashes) {
+    var callback = arguments[arguments.length - 1];
+    if (typeof(callback) !== 'function')
+      callback = function (){};
+    if (!publicationsready())
+      return whenpublications(callback, function () {
+        GuardTime.verifyBatch(tokens, hashes, callback);
+      });
+    if (Array.isArray(tokens))
+      tokens = tokens.map(function (ts) {
+        return ts instanceof TimeSignature ? ts.getContent() : ts;
       });
-      if (pubok.listeners('pubOK').length <= 1)
-        GuardTime.loadPublications( function(err){ pubok.emit('pubOK', err); } );
-      return;
-    }
     try {
-      properties = ts.verify();
-      properties.verification_status |= ts.compareHash(hash, alg);
-      var is_new = ts.getRegisteredTime().getTime() > GuardTime.publications.last.getTime();
-      if (!ts.isExtended() && !is_new) {
-        return GuardTime.extend(ts, function(err, xts) {
-          if (err) {
-            //no failover:
-            // return callback(err);
-            //with failover:
-            xts = ts;
-          }
-          try {
-            properties = xts.verify();
-            properties.verification_status |= xts.compareHash(hash, alg);
-            properties.verification_status |= xts.checkPublication(GuardTime.publications.data);
-          } catch (err) { return callback(err); }
-          callback(null, properties.verification_status, properties);
-        });
-      }
-      properties.verification_status |= ts.checkPublication(GuardTime.publications.data);
+      TimeSignature.verifyBatch(tokens, hashes, GuardTime.publications.file, callback);
     } catch (err) {
       return callback(err);
     }
-    callback(null, properties.verification_status, properties);
+  },
+
+  // bulk verification, see VerifyEngine; callback(err, summary) is optional
+  verifyMany: function (items, options, callback) {
+    if (typeof(options) === 'function') {
+      callback = options;
+      options = {};
+    }
+    var engine = new VerifyEngine(items, options);
+    if (callback)
+      engine.once('end', callback);
+    process.nextTick(function () { engine.start(); });
+    return engine;
   },
 
   verifyFile: function(filename, ts) {
@@ -312,12 +1305,11 @@ var GuardTime = module.exports = {
     if (typeof(callback) !== 'function')
       callback = function (){};
     try {
-      var hash = crypto.createHash(ts.getHashAlgorithm());
-      fs.createReadStream(filename, {'bufferSize': 128*1024})
-        .on('data', function(chunk) { hash.update(chunk); })
-        .on('error', callback)
-        .on('end', function() {
-          GuardTime.verifyHash(hash.digest(), ts.getHashAlgorithm(), ts, callback);
+      var alg = ts.getHashAlgorithm();
+      TimeSignature.hashFile(filename, alg, function (err, digest) {
+        if (err)
+          return callback(err);
+        GuardTime.verifyHash(digest, alg, ts, callback);
       });
     } catch (err) {
       return callback(err);
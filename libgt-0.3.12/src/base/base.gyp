@@ -28,6 +28,8 @@
         'gt_internal.h',
         'gt_publicationsfile.c',
         'gt_publicationsfile.h',
+        'gt_sha256mb.c',
+        'gt_sha256mb.h',
         'gt_timestamp.c',
         'gt_truststore.c',
         'hashchain.c',
@@ -1023,6 +1023,30 @@ int GTTimestamp_isEarlierThan(const GTTimestamp *this_timestamp,
 int GTTimestamp_verify(const GTTimestamp *timestamp,
 		int parse_data, GTVerificationInfo **verification_info);
 
+/**
+ * \ingroup verification
+ *
+ * Checks many timestamps like #GTTimestamp_verify(). The hash chains of
+ * all of them are calculated together, several SHA-256 digests at a time
+ * where the CPU allows, which is faster than verifying the timestamps one
+ * by one.
+ *
+ * \param count \c (in) - Number of timestamps.
+ * \param timestamps \c (in) - Pointers to the timestamps.
+ * \param parse_data \c (in) - As for #GTTimestamp_verify().
+ * \param verification_infos \c (out) - Array of \p count pointers, each
+ * receiving the verification info of respective timestamp or \c NULL if
+ * its verification failed.
+ * \param results \c (out) - Array of \p count integers receiving the
+ * status code of #GTTimestamp_verify() for respective timestamp.
+ *
+ * \return status code \c GT_OK, when the timestamps were checked (see
+ * \p results), otherwise an error code.
+ */
+int GTTimestamp_verifyMany(size_t count,
+		const GTTimestamp *const *timestamps, int parse_data,
+		GTVerificationInfo **verification_infos, int *results);
+
 /**
  * \ingroup verification
  *
@@ -1465,7 +1489,7 @@ int GT_loadFile(const char *path, unsigned char **out_data, size_t *out_size);
  *
  * Hashes contents of the given file.
  *
- * \param path \c (in) Name of the file to read.
+ * \param path \c (in) Name of the file to read; UTF-8 on Windows.
  * \param hash_algorithm \c (in) - Identifier of the hash algorithm.
  * See #GTHashAlgorithm for possible values.
  * \param data_hash \c (out) - Pointer that will receive pointer to the
@@ -22,6 +22,21 @@
 #include <stdio.h>
 #include <errno.h>
 
+#ifdef _WIN32
+#include <windows.h>
+#else /* _WIN32 */
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <fcntl.h>
+#include <unistd.h>
+#endif /* not _WIN32 */
+
+/*
+ * Size of blocks read by GT_hashFile(). Large blocks keep the number of
+ * system calls low so that hashing runs at disk or hash function speed.
+ */
+#define HASH_FILE_BLOCK_SIZE (1024 * 1024)
+
 /**/
 
 int GT_loadFile(const char *path, unsigned char **out_data, size_t *out_size)
@@ -126,28 +141,65 @@ cleanup:
 
 /**/
 
+#ifdef _WIN32
+
+/*
+ * Opens a file named in UTF-8 for reading; fopen() would take the name in
+ * the ANSI code page.
+ */
+static FILE *openUtf8(const char *path)
+{
+	FILE *f;
+	wchar_t *wpath;
+	int len;
+
+	len = MultiByteToWideChar(CP_UTF8, 0, path, -1, NULL, 0);
+	if (len == 0) {
+		errno = EINVAL;
+		return NULL;
+	}
+	wpath = GT_malloc(len * sizeof(wchar_t));
+	if (wpath == NULL) {
+		errno = ENOMEM;
+		return NULL;
+	}
+	MultiByteToWideChar(CP_UTF8, 0, path, -1, wpath, len);
+	f = _wfopen(wpath, L"rb");
+	GT_free(wpath);
+	return f;
+}
+
 int GT_hashFile(const char *path, int hash_algorithm, GTDataHash **data_hash)
 {
 	int retval = GT_UNKNOWN_ERROR;
 	GTDataHash *tmp_data_hash = NULL;
 	FILE *f = NULL;
-	unsigned char buf[32 * 1024];
+	unsigned char *buf = NULL;
 	size_t read_size;
+	int saved_errno = 0;
 
 	retval = GTDataHash_open(hash_algorithm, &tmp_data_hash);
 	if (retval != GT_OK) {
 		goto cleanup;
 	}
 
-	f = fopen(path, "rb");
+	buf = GT_malloc(HASH_FILE_BLOCK_SIZE);
+	if (buf == NULL) {
+		retval = GT_OUT_OF_MEMORY;
+		goto cleanup;
+	}
+
+	f = openUtf8(path);
 	if (f == NULL) {
+		saved_errno = errno;
 		retval = GT_IO_ERROR;
 		goto cleanup;
 	}
 
 	do {
-		read_size = fread(buf, 1, sizeof(buf), f);
+		read_size = fread(buf, 1, HASH_FILE_BLOCK_SIZE, f);
 		if (ferror(f)) {
+			saved_errno = errno;
 			retval = GT_IO_ERROR;
 			goto cleanup;
 		}
@@ -172,7 +224,99 @@ cleanup:
 	if (f != NULL) {
 		fclose(f);
 	}
+	GT_free(buf);
 	GTDataHash_free(tmp_data_hash);
+	/* The cleanup must not clobber the reason of an I/O error. */
+	if (saved_errno != 0) {
+		errno = saved_errno;
+	}
 
 	return retval;
 }
+
+#else /* _WIN32 */
+
+/*
+ * Plain read() of large blocks with a sequential access hint to the kernel
+ * so that readahead keeps the disk busy while the data is hashed. mmap() is
+ * deliberately not used: a file truncated during hashing would raise
+ * SIGBUS in the calling process.
+ */
+int GT_hashFile(const char *path, int hash_algorithm, GTDataHash **data_hash)
+{
+	int retval = GT_UNKNOWN_ERROR;
+	GTDataHash *tmp_data_hash = NULL;
+	int fd = -1;
+	unsigned char *buf = NULL;
+	ssize_t read_size;
+	int saved_errno = 0;
+
+	retval = GTDataHash_open(hash_algorithm, &tmp_data_hash);
+	if (retval != GT_OK) {
+		goto cleanup;
+	}
+
+	buf = GT_malloc(HASH_FILE_BLOCK_SIZE);
+	if (buf == NULL) {
+		retval = GT_OUT_OF_MEMORY;
+		goto cleanup;
+	}
+
+	fd = open(path, O_RDONLY);
+	if (fd < 0) {
+		saved_errno = errno;
+		retval = GT_IO_ERROR;
+		goto cleanup;
+	}
+
+#if defined(POSIX_FADV_SEQUENTIAL)
+	posix_fadvise(fd, 0, 0, POSIX_FADV_SEQUENTIAL);
+#elif defined(F_RDAHEAD)
+	fcntl(fd, F_RDAHEAD, 1);
+#endif
+
+	for (;;) {
+		read_size = read(fd, buf, HASH_FILE_BLOCK_SIZE);
+		if (read_size < 0) {
+			if (errno == EINTR) {
+				continue;
+			}
+			saved_errno = errno;
+			retval = GT_IO_ERROR;
+			goto cleanup;
+		}
+		if (read_size == 0) {
+			break;
+		}
+		retval = GTDataHash_add(tmp_data_hash, buf, read_size);
+		if (retval != GT_OK) {
+			goto cleanup;
+		}
+	}
+
+	retval = GTDataHash_close(tmp_data_hash);
+	if (retval != GT_OK) {
+		goto cleanup;
+	}
+
+	*data_hash = tmp_data_hash;
+	tmp_data_hash = NULL;
+
+	retval = GT_OK;
+
+cleanup:
+
+	if (fd >= 0) {
+		close(fd);
+	}
+	GT_free(buf);
+	GTDataHash_free(tmp_data_hash);
+	/* The cleanup must not clobber the reason of an I/O error. */
+	if (saved_errno != 0) {
+		errno = saved_errno;
+	}
+
+	return retval;
+}
+
+#endif /* not _WIN32 */
@@ -0,0 +1,344 @@
+/*
+ * Copyright 2008-2010 GuardTime AS
+ *
+ * This file is part of the GuardTime client SDK.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or
+ * implied. See the License for the specific language governing
+ * permissions and limitations under the License.
+ */
+
+#include "gt_sha256mb.h"
+#include "hashchain.h"
+
+#include <assert.h>
+#include <string.h>
+
+/*
+ * Multi-buffer SHA-256: eight messages are hashed at once, each in one
+ * 32-bit lane of the AVX2 registers. This pays off for many short
+ * messages, such as the steps of hash chains verified in a batch, where
+ * a single message leaves most of the vector width unused.
+ *
+ * The AVX2 kernel is compiled with a target attribute (no special compiler
+ * flags needed) and chosen at run time; other CPUs hash the messages one
+ * by one through OpenSSL.
+ */
+
+#if (defined(__x86_64__) || defined(__i386__)) && \
+		(defined(__clang__) || \
+		 (defined(__GNUC__) && (__GNUC__ > 4 || \
+			(__GNUC__ == 4 && __GNUC_MINOR__ >= 9))))
+#define SHA256MB_AVX2
+#define AVX2_TARGET __attribute__((target("avx2")))
+#include <cpuid.h>
+#include <immintrin.h>
+#elif defined(_MSC_VER) && _MSC_VER >= 1700 && \
+		(defined(_M_X64) || defined(_M_IX86))
+#define SHA256MB_AVX2
+#define AVX2_TARGET
+#include <immintrin.h>
+#include <intrin.h>
+#endif
+
+#ifdef SHA256MB_AVX2
+
+static const unsigned int K[64] = {
+	0x428a2f98, 0x71374491, 0xb5c0fbcf, 0xe9b5dba5,
+	0x3956c25b, 0x59f111f1, 0x923f82a4, 0xab1c5ed5,
+	0xd807aa98, 0x12835b01, 0x243185be, 0x550c7dc3,
+	0x72be5d74, 0x80deb1fe, 0x9bdc06a7, 0xc19bf174,
+	0xe49b69c1, 0xefbe4786, 0x0fc19dc6, 0x240ca1cc,
+	0x2de92c6f, 0x4a7484aa, 0x5cb0a9dc, 0x76f988da,
+	0x983e5152, 0xa831c66d, 0xb00327c8, 0xbf597fc7,
+	0xc6e00bf3, 0xd5a79147, 0x06ca6351, 0x14292967,
+	0x27b70a85, 0x2e1b2138, 0x4d2c6dfc, 0x53380d13,
+	0x650a7354, 0x766a0abb, 0x81c2c92e, 0x92722c85,
+	0xa2bfe8a1, 0xa81a664b, 0xc24b8b70, 0xc76c51a3,
+	0xd192e819, 0xd6990624, 0xf40e3585, 0x106aa070,
+	0x19a4c116, 0x1e376c08, 0x2748774c, 0x34b0bcb5,
+	0x391c0cb3, 0x4ed8aa4a, 0x5b9cca4f, 0x682e6ff3,
+	0x748f82ee, 0x78a5636f, 0x84c87814, 0x8cc70208,
+	0x90befffa, 0xa4506ceb, 0xbef9a3f7, 0xc67178f2
+};
+
+static const unsigned int H0[8] = {
+	0x6a09e667, 0xbb67ae85, 0x3c6ef372, 0xa54ff53a,
+	0x510e527f, 0x9b05688c, 0x1f83d9ab, 0x5be0cd19
+};
+
+#define ROTR(x, n) _mm256_or_si256(_mm256_srli_epi32((x), (n)), \
+		_mm256_slli_epi32((x), 32 - (n)))
+#define XOR3(a, b, c) _mm256_xor_si256(_mm256_xor_si256((a), (b)), (c))
+#define ADD(a, b) _mm256_add_epi32((a), (b))
+
+/*
+ * Compresses one block in each lane. state[i][lane] is word i of the
+ * state of a lane, block[j][lane] word j of its message block.
+ */
+static void AVX2_TARGET sha256x8Compress(unsigned int state[8][8],
+		unsigned int block[16][8])
+{
+	__m256i w[16];
+	__m256i a, b, c, d, e, f, g, h, t1, t2;
+	int i;
+
+	a = _mm256_loadu_si256((const __m256i *) state[0]);
+	b = _mm256_loadu_si256((const __m256i *) state[1]);
+	c = _mm256_loadu_si256((const __m256i *) state[2]);
+	d = _mm256_loadu_si256((const __m256i *) state[3]);
+	e = _mm256_loadu_si256((const __m256i *) state[4]);
+	f = _mm256_loadu_si256((const __m256i *) state[5]);
+	g = _mm256_loadu_si256((const __m256i *) state[6]);
+	h = _mm256_loadu_si256((const __m256i *) state[7]);
+
+	for (i = 0; i < 64; ++i) {
+		if (i < 16) {
+			w[i] = _mm256_loadu_si256((const __m256i *) block[i]);
+		} else {
+			__m256i w15 = w[(i - 15) & 15], w2 = w[(i - 2) & 15];
+			w[i & 15] = ADD(ADD(w[i & 15],
+						XOR3(ROTR(w15, 7), ROTR(w15, 18),
+							_mm256_srli_epi32(w15, 3))),
+					ADD(w[(i - 7) & 15],
+						XOR3(ROTR(w2, 17), ROTR(w2, 19),
+							_mm256_srli_epi32(w2, 10))));
+		}
+
+		t1 = ADD(ADD(h, XOR3(ROTR(e, 6), ROTR(e, 11), ROTR(e, 25))),
+				ADD(_mm256_xor_si256(_mm256_and_si256(e, f),
+						_mm256_andnot_si256(e, g)),
+					ADD(_mm256_set1_epi32(K[i]), w[i & 15])));
+		t2 = ADD(XOR3(ROTR(a, 2), ROTR(a, 13), ROTR(a, 22)),
+				XOR3(_mm256_and_si256(a, b), _mm256_and_si256(a, c),
+					_mm256_and_si256(b, c)));
+		h = g;
+		g = f;
+		f = e;
+		e = ADD(d, t1);
+		d = c;
+		c = b;
+		b = a;
+		a = ADD(t1, t2);
+	}
+
+#define FEED(i, x) _mm256_storeu_si256((__m256i *) state[i], \
+		ADD(_mm256_loadu_si256((const __m256i *) state[i]), (x)))
+	FEED(0, a);
+	FEED(1, b);
+	FEED(2, c);
+	FEED(3, d);
+	FEED(4, e);
+	FEED(5, f);
+	FEED(6, g);
+	FEED(7, h);
+#undef FEED
+}
+
+static unsigned int loadBE32(const unsigned char *p)
+{
+	return ((unsigned int) p[0] << 24) | ((unsigned int) p[1] << 16) |
+		((unsigned int) p[2] << 8) | p[3];
+}
+
+/* Hashes up to GT_SHA256MB_MAX_LANES messages in parallel. */
+static void sha256x8(size_t count, const unsigned char *const *data,
+		const size_t *data_len, unsigned char *const *result)
+{
+	/* The last one or two blocks of each message, with the padding. */
+	unsigned char tail[GT_SHA256MB_MAX_LANES][128];
+	size_t full_blocks[GT_SHA256MB_MAX_LANES];
+	size_t blocks[GT_SHA256MB_MAX_LANES];
+	size_t max_blocks = 0;
+	unsigned int state[8][8];
+	unsigned int block[16][8];
+	const unsigned char *src;
+	size_t lane, b, rest, tail_len;
+	unsigned long long bits;
+	int i;
+
+	assert(count <= GT_SHA256MB_MAX_LANES);
+
+	for (lane = 0; lane < GT_SHA256MB_MAX_LANES; ++lane) {
+		for (i = 0; i < 8; ++i) {
+			state[i][lane] = H0[i];
+		}
+		if (lane >= count) {
+			/* Idle lane, hashes the tail of lane 0. */
+			full_blocks[lane] = 0;
+			blocks[lane] = 0;
+			continue;
+		}
+
+		full_blocks[lane] = data_len[lane] / 64;
+		rest = data_len[lane] % 64;
+		tail_len = rest + 9 <= 64 ? 64 : 128;
+		memcpy(tail[lane], data[lane] + full_blocks[lane] * 64, rest);
+		memset(tail[lane] + rest, 0, tail_len - rest);
+		tail[lane][rest] = 0x80;
+		bits = (unsigned long long) data_len[lane] * 8;
+		for (i = 0; i < 8; ++i) {
+			tail[lane][tail_len - 1 - i] = (unsigned char) (bits >> (8 * i));
+		}
+		blocks[lane] = full_blocks[lane] + tail_len / 64;
+		if (blocks[lane] > max_blocks) {
+			max_blocks = blocks[lane];
+		}
+	}
+
+	for (b = 0; b < max_blocks; ++b) {
+		for (lane = 0; lane < GT_SHA256MB_MAX_LANES; ++lane) {
+			if (b < full_blocks[lane]) {
+				src = data[lane] + b * 64;
+			} else if (b < blocks[lane]) {
+				src = tail[lane] + (b - full_blocks[lane]) * 64;
+			} else {
+				src = tail[0];
+			}
+			for (i = 0; i < 16; ++i) {
+				block[i][lane] = loadBE32(src + 4 * i);
+			}
+		}
+
+		sha256x8Compress(state, block);
+
+		for (lane = 0; lane < count; ++lane) {
+			if (blocks[lane] != b + 1) {
+				continue;
+			}
+			for (i = 0; i < 8; ++i) {
+				result[lane][4 * i] = (unsigned char) (state[i][lane] >> 24);
+				result[lane][4 * i + 1] = (unsigned char) (state[i][lane] >> 16);
+				result[lane][4 * i + 2] = (unsigned char) (state[i][lane] >> 8);
+				result[lane][4 * i + 3] = (unsigned char) state[i][lane];
+			}
+		}
+	}
+}
+
+static void cpuid(unsigned int leaf, unsigned int *regs)
+{
+#ifdef _MSC_VER
+	__cpuidex((int *) regs, leaf, 0);
+#else
+	__cpuid_count(leaf, 0, regs[0], regs[1], regs[2], regs[3]);
+#endif
+}
+
+/* Whether the OS saves the YMM registers. */
+static int ymmEnabled(void)
+{
+#ifdef _MSC_VER
+	return (_xgetbv(0) & 6) == 6;
+#else
+	unsigned int eax, edx;
+
+	/* xgetbv, spelled out for old assemblers */
+	__asm__ volatile (".byte 0x0f, 0x01, 0xd0" :
+			"=a" (eax), "=d" (edx) : "c" (0));
+	return (eax & 6) == 6;
+#endif
+}
+
+/*
+ * Whether the AVX2 kernel can run on this CPU. With \p if_faster, only
+ * where it is faster than OpenSSL: not with the SHA extensions.
+ */
+static int detectAvx2(int if_faster)
+{
+	unsigned int regs[4];
+
+	cpuid(0, regs);
+	if (regs[0] < 7) {
+		return 0;
+	}
+
+	/* OSXSAVE and AVX */
+	cpuid(1, regs);
+	if ((regs[2] & (1u << 27)) == 0 || (regs[2] & (1u << 28)) == 0 ||
+			!ymmEnabled()) {
+		return 0;
+	}
+
+	/* AVX2, and the SHA extensions */
+	cpuid(7, regs);
+	if ((regs[1] & (1u << 5)) == 0) {
+		return 0;
+	}
+	if (if_faster && (regs[1] & (1u << 29)) != 0) {
+		return 0;
+	}
+
+	return 1;
+}
+
+/* Detected once; concurrent callers store the same value. */
+static volatile int lanes = 0;
+
+#endif /* SHA256MB_AVX2 */
+
+/**/
+
+int GT_sha256ManyLanes(void)
+{
+#ifdef SHA256MB_AVX2
+	if (lanes == 0) {
+		lanes = detectAvx2(1) ? GT_SHA256MB_MAX_LANES : 1;
+	}
+	return lanes;
+#else
+	return 1;
+#endif
+}
+
+/**/
+
+int GT_sha256ManySetLanes(int n)
+{
+#ifdef SHA256MB_AVX2
+	if (n == 0) {
+		lanes = 0;
+	} else if (n >= GT_SHA256MB_MAX_LANES && detectAvx2(0)) {
+		lanes = GT_SHA256MB_MAX_LANES;
+	} else {
+		lanes = 1;
+	}
+	return GT_sha256ManyLanes();
+#else
+	(void) n;
+	return 1;
+#endif
+}
+
+/**/
+
+void GT_sha256Many(size_t count, const unsigned char *const *data,
+		const size_t *data_len, unsigned char *const *result)
+{
+	size_t i = 0;
+
+#ifdef SHA256MB_AVX2
+	if (GT_sha256ManyLanes() > 1) {
+		/* A lone message is hashed faster by OpenSSL. */
+		while (count - i > 1) {
+			size_t n = count - i;
+
+			if (n > GT_SHA256MB_MAX_LANES) {
+				n = GT_SHA256MB_MAX_LANES;
+			}
+			sha256x8(n, data + i, data_len + i, result + i);
+			i += n;
+		}
+	}
+#endif
+
+	for (; i < count; ++i) {
+		GT_calculateDigest(data[i], data_len[i], result[i], GT_HASHALG_SHA256);
+	}
+}
@@ -0,0 +1,67 @@
+/*
+ * Copyright 2008-2010 GuardTime AS
+ *
+ * This file is part of the GuardTime client SDK.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or
+ * implied. See the License for the specific language governing
+ * permissions and limitations under the License.
+ */
+
+#ifndef GT_SHA256MB_H_INCLUDED
+#define GT_SHA256MB_H_INCLUDED
+
+#include <stdlib.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/** Largest number of messages hashed in parallel. */
+#define GT_SHA256MB_MAX_LANES 8
+
+/**
+ * Returns the number of messages GT_sha256Many() hashes in parallel on
+ * this CPU: \c GT_SHA256MB_MAX_LANES when the AVX2 kernel is used, 1 when
+ * the messages are hashed one by one through OpenSSL. The latter is also
+ * chosen on CPUs with the SHA extensions, which OpenSSL uses.
+ */
+int GT_sha256ManyLanes(void);
+
+/**
+ * Overrides the choice of GT_sha256ManyLanes(), for testing: with
+ * \c GT_SHA256MB_MAX_LANES the AVX2 kernel is used wherever the CPU has
+ * AVX2, also with the SHA extensions; with 1 the messages are hashed one
+ * by one; with 0 the choice is made for this CPU again. Not to be called
+ * while GT_sha256Many() is in use.
+ *
+ * \return The number of lanes now in effect.
+ */
+int GT_sha256ManySetLanes(int n);
+
+/**
+ * Calculates SHA-256 digests of \p count independent messages.
+ *
+ * \param count Number of messages.
+ *
+ * \param data Pointers to the messages.
+ *
+ * \param data_len Lengths of the messages, in bytes.
+ *
+ * \param result Pointers to the buffers of 32 bytes receiving the digests.
+ * A result buffer may be the same as the message it is the digest of.
+ */
+void GT_sha256Many(size_t count, const unsigned char *const *data,
+		const size_t *data_len, unsigned char *const *result);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* not GT_SHA256MB_H_INCLUDED */
@@ -60,6 +60,13 @@ struct GTTimestamp_st {
 	 * sync with the contents of the token.
 	 */
 	GTTimeSignature *time_signature;
+	/**
+	 * Location and history hash chains of the time_signature, decoded for
+	 * the checks and calculations done on verification. Must be kept in
+	 * sync with the time_signature.
+	 */
+	GTHashChain *location;
+	GTHashChain *history;
 };
 
 /**/
@@ -74,6 +81,8 @@ static GTTimestamp* GTTimestamp_new()
 		timestamp->tst_info = NULL;
 		timestamp->signer_info = NULL;
 		timestamp->time_signature = NULL;
+		timestamp->location = NULL;
+		timestamp->history = NULL;
 	}
 
 	return timestamp;
@@ -87,6 +96,8 @@ void GTTimestamp_free(GTTimestamp *timestamp)
 		PKCS7_free(timestamp->token);
 		GTTSTInfo_free(timestamp->tst_info);
 		GTTimeSignature_free(timestamp->time_signature);
+		GT_hashChainFree(timestamp->location);
+		GT_hashChainFree(timestamp->history);
 		GT_free(timestamp);
 	}
 }
@@ -168,8 +179,12 @@ static int GTTimestamp_updateTimeSignature(GTTimestamp *timestamp)
 	}
 
 	GTTimeSignature_free(timestamp->time_signature);
+	GT_hashChainFree(timestamp->location);
+	GT_hashChainFree(timestamp->history);
 	timestamp->signer_info = NULL;
 	timestamp->time_signature = NULL;
+	timestamp->location = NULL;
+	timestamp->history = NULL;
 
 	if (!PKCS7_type_is_signed(timestamp->token)) {
 		res = GT_INVALID_FORMAT;
@@ -206,6 +221,24 @@ static int GTTimestamp_updateTimeSignature(GTTimestamp *timestamp)
 		goto cleanup;
 	}
 
+	/* Decode the hash chains once here rather than on every verification.
+	 * Malformed chains are not rejected yet, the syntactic check of the
+	 * verification reports them. */
+	res = GT_hashChainCompile(
+			ASN1_STRING_data(timestamp->time_signature->location),
+			ASN1_STRING_length(timestamp->time_signature->location),
+			&timestamp->location);
+	if (res != GT_OK) {
+		goto cleanup;
+	}
+	res = GT_hashChainCompile(
+			ASN1_STRING_data(timestamp->time_signature->history),
+			ASN1_STRING_length(timestamp->time_signature->history),
+			&timestamp->history);
+	if (res != GT_OK) {
+		goto cleanup;
+	}
+
 	res = GT_OK;
 
 cleanup:
@@ -2070,24 +2103,21 @@ static int checkTimestampSyntax(const GTTimestamp *timestamp)
 		return tmp_res;
 	}
 
-	/* Check HashChain values. */
+	/* Check HashChain values. These were found when the chains were
+	 * decoded. */
 
-	tmp_res = GT_checkHashChain(timestamp->time_signature->location);
-	if (tmp_res != GT_OK) {
-		return tmp_res;
+	if (timestamp->location->syntax_status != GT_OK) {
+		return timestamp->location->syntax_status;
 	}
 
-	tmp_res = GT_checkHashChain(timestamp->time_signature->history);
-	if (tmp_res != GT_OK) {
-		return tmp_res;
+	if (timestamp->history->syntax_status != GT_OK) {
+		return timestamp->history->syntax_status;
 	}
 
 	/* Check length consistency of location. */
 
-	tmp_res = GT_checkHashChainLengthConsistent(
-			timestamp->time_signature->location);
-	if (tmp_res != GT_OK) {
-		return tmp_res;
+	if (timestamp->location->length_status != GT_OK) {
+		return timestamp->location->length_status;
 	}
 
 	/* Check that signed attributes contains proper content type. */
@@ -2114,32 +2144,29 @@ static int checkTimestampSyntax(const GTTimestamp *timestamp)
 	return GT_OK;
 }
 
-/* Helper for performing of the hash chain check. */
-static int checkHashChain(const GTTimestamp *timestamp)
+/*
+ * First part of the hash chain check: checks the digest of the TSTInfo and
+ * finds the input for the hash chain calculation.
+ */
+static int prepareHashChainCheck(const GTTimestamp *timestamp,
+		ASN1_OCTET_STRING **input, int *alg_server)
 {
 	int res = GT_UNKNOWN_ERROR;
 	int tmp_res;
-	int alg_server;
 	int alg_client;
 	unsigned char *tmp_der = NULL;
 	int tmp_der_len;
 	ASN1_OCTET_STRING *tmp_imprint = NULL;
 	ASN1_TYPE *attribute_value;
-	ASN1_OCTET_STRING *input = NULL;
-	unsigned char *loc_output = NULL;
-	size_t loc_output_len;
-	unsigned char *hist_output = NULL;
-	size_t hist_output_len;
-	ASN1_OCTET_STRING *output = NULL;
 
 	if (ASN1_STRING_length(timestamp->time_signature->
 				publishedData->publicationImprint) < 1) {
 		res = GT_INVALID_FORMAT;
 		goto cleanup;
 	}
-	alg_server = ASN1_STRING_data(timestamp->time_signature->
+	*alg_server = ASN1_STRING_data(timestamp->time_signature->
 			publishedData->publicationImprint)[0];
-	if (!GT_isSupportedHashAlgorithm(alg_server)) {
+	if (!GT_isSupportedHashAlgorithm(*alg_server)) {
 		res = GT_UNTRUSTED_HASH_ALGORITHM;
 		goto cleanup;
 	}
@@ -2200,41 +2227,35 @@ static int checkHashChain(const GTTimestamp *timestamp)
 		res = GT_CRYPTO_FAILURE;
 		goto cleanup;
 	}
-	assert(input == NULL);
 	tmp_res =
-		GT_calculateDataImprint(tmp_der, tmp_der_len, alg_client, &input);
+		GT_calculateDataImprint(tmp_der, tmp_der_len, alg_client, input);
 	if (tmp_res != GT_OK) {
 		res = tmp_res;
 		goto cleanup;
 	}
 
-	/* Apply location hash chain to the input. */
-	assert(loc_output == NULL);
-	tmp_res = GT_hashChainCalculate(
-			ASN1_STRING_data(timestamp->time_signature->location),
-			ASN1_STRING_length(timestamp->time_signature->location),
-			ASN1_STRING_data(input),
-			ASN1_STRING_length(input),
-			&loc_output, &loc_output_len);
-	if (tmp_res != GT_OK) {
-		res = tmp_res;
-		goto cleanup;
-	}
+	res = GT_OK;
 
-	/* Apply history hash chain to the input. */
-	assert(hist_output == NULL);
-	tmp_res = GT_hashChainCalculateNoDepth(
-			ASN1_STRING_data(timestamp->time_signature->history),
-			ASN1_STRING_length(timestamp->time_signature->history),
-			loc_output, loc_output_len,
-			&hist_output, &hist_output_len);
-	if (tmp_res != GT_OK) {
-		res = tmp_res;
-		goto cleanup;
-	}
+cleanup:
+	OPENSSL_free(tmp_der);
+	ASN1_OCTET_STRING_free(tmp_imprint);
+
+	return res;
+}
+
+/*
+ * Last part of the hash chain check: compares the hash of the history
+ * chain output with the publication imprint.
+ */
+static int finishHashChainCheck(const GTTimestamp *timestamp,
+		int alg_server, const unsigned char *hist_output,
+		size_t hist_output_len)
+{
+	int res = GT_UNKNOWN_ERROR;
+	int tmp_res;
+	ASN1_OCTET_STRING *output = NULL;
 
 	/* Perform final hashing step. */
-	assert(output == NULL);
 	tmp_res = GT_calculateDataImprint(
 			hist_output, hist_output_len, alg_server, &output);
 	if (tmp_res != GT_OK) {
@@ -2253,16 +2274,174 @@ static int checkHashChain(const GTTimestamp *timestamp)
 	res = GT_OK;
 
 cleanup:
-	OPENSSL_free(tmp_der);
-	ASN1_OCTET_STRING_free(tmp_imprint);
-	ASN1_OCTET_STRING_free(input);
-	OPENSSL_free(loc_output);
-	OPENSSL_free(hist_output);
 	ASN1_OCTET_STRING_free(output);
 
 	return res;
 }
 
+/* Helper for performing of the hash chain check. */
+static int checkHashChain(const GTTimestamp *timestamp)
+{
+	int res = GT_UNKNOWN_ERROR;
+	int tmp_res;
+	int alg_server;
+	ASN1_OCTET_STRING *input = NULL;
+	unsigned char loc_output[GT_HASHCHAIN_MAX_RESULT_LEN];
+	size_t loc_output_len;
+	unsigned char hist_output[GT_HASHCHAIN_MAX_RESULT_LEN];
+	size_t hist_output_len;
+
+	tmp_res = prepareHashChainCheck(timestamp, &input, &alg_server);
+	if (tmp_res != GT_OK) {
+		res = tmp_res;
+		goto cleanup;
+	}
+
+	/* Apply location hash chain to the input. */
+	tmp_res = GT_hashChainRun(timestamp->location,
+			ASN1_STRING_data(input), ASN1_STRING_length(input),
+			loc_output, &loc_output_len, 1);
+	if (tmp_res != GT_OK) {
+		res = tmp_res;
+		goto cleanup;
+	}
+
+	/* Apply history hash chain to the input. */
+	tmp_res = GT_hashChainRun(timestamp->history,
+			loc_output, loc_output_len,
+			hist_output, &hist_output_len, 0);
+	if (tmp_res != GT_OK) {
+		res = tmp_res;
+		goto cleanup;
+	}
+
+	res = finishHashChainCheck(timestamp, alg_server,
+			hist_output, hist_output_len);
+
+cleanup:
+	ASN1_OCTET_STRING_free(input);
+
+	return res;
+}
+
+/*
+ * Hash chain checks of many timestamps, with the location and history
+ * chains of all of them calculated in lockstep by GT_hashChainRunMany().
+ * Timestamps whose entry in \p results is not GT_OK on entry are skipped.
+ */
+static int checkHashChains(size_t count,
+		const GTTimestamp *const *timestamps, int *results)
+{
+	int res = GT_UNKNOWN_ERROR;
+	ASN1_OCTET_STRING **inputs = NULL;
+	int *alg_servers = NULL;
+	size_t *lane_of = NULL;
+	const GTHashChain **chains = NULL;
+	const unsigned char **data = NULL;
+	size_t *data_lengths = NULL;
+	unsigned char *loc_outputs = NULL;
+	size_t *loc_output_lengths = NULL;
+	unsigned char *hist_outputs = NULL;
+	size_t *hist_output_lengths = NULL;
+	int *statuses = NULL;
+	size_t i, lanes = 0, hist_lanes = 0;
+
+	inputs = OPENSSL_malloc(count * sizeof(ASN1_OCTET_STRING *));
+	alg_servers = OPENSSL_malloc(count * sizeof(int));
+	lane_of = OPENSSL_malloc(count * sizeof(size_t));
+	chains = OPENSSL_malloc(count * sizeof(GTHashChain *));
+	data = OPENSSL_malloc(count * sizeof(unsigned char *));
+	data_lengths = OPENSSL_malloc(count * sizeof(size_t));
+	loc_outputs = OPENSSL_malloc(count * GT_HASHCHAIN_MAX_RESULT_LEN);
+	loc_output_lengths = OPENSSL_malloc(count * sizeof(size_t));
+	hist_outputs = OPENSSL_malloc(count * GT_HASHCHAIN_MAX_RESULT_LEN);
+	hist_output_lengths = OPENSSL_malloc(count * sizeof(size_t));
+	statuses = OPENSSL_malloc(count * sizeof(int));
+	if (count > 0 && (inputs == NULL || alg_servers == NULL ||
+				lane_of == NULL || chains == NULL || data == NULL ||
+				data_lengths == NULL || loc_outputs == NULL ||
+				loc_output_lengths == NULL || hist_outputs == NULL ||
+				hist_output_lengths == NULL || statuses == NULL)) {
+		res = GT_OUT_OF_MEMORY;
+		goto cleanup;
+	}
+
+	for (i = 0; i < count; ++i) {
+		inputs[i] = NULL;
+		if (results[i] != GT_OK) {
+			continue;
+		}
+		results[i] = prepareHashChainCheck(timestamps[i],
+				&inputs[i], &alg_servers[i]);
+		if (results[i] != GT_OK) {
+			continue;
+		}
+		lane_of[lanes] = i;
+		chains[lanes] = timestamps[i]->location;
+		data[lanes] = ASN1_STRING_data(inputs[i]);
+		data_lengths[lanes] = ASN1_STRING_length(inputs[i]);
+		++lanes;
+	}
+
+	/* Apply location hash chains to the inputs. */
+	GT_hashChainRunMany(lanes, chains, data, data_lengths,
+			loc_outputs, loc_output_lengths, statuses, 1);
+
+	/* Apply history hash chains to the outputs of the above, leaving out
+	 * the failed ones. The outputs are compacted in place, each moving
+	 * only to a slot already consumed. */
+	for (i = 0; i < lanes; ++i) {
+		if (statuses[i] != GT_OK) {
+			results[lane_of[i]] = statuses[i];
+			continue;
+		}
+		lane_of[hist_lanes] = lane_of[i];
+		chains[hist_lanes] = timestamps[lane_of[i]]->history;
+		memmove(loc_outputs + hist_lanes * GT_HASHCHAIN_MAX_RESULT_LEN,
+				loc_outputs + i * GT_HASHCHAIN_MAX_RESULT_LEN,
+				loc_output_lengths[i]);
+		data[hist_lanes] =
+			loc_outputs + hist_lanes * GT_HASHCHAIN_MAX_RESULT_LEN;
+		data_lengths[hist_lanes] = loc_output_lengths[i];
+		++hist_lanes;
+	}
+	GT_hashChainRunMany(hist_lanes, chains, data, data_lengths,
+			hist_outputs, hist_output_lengths, statuses, 0);
+
+	for (i = 0; i < hist_lanes; ++i) {
+		if (statuses[i] != GT_OK) {
+			results[lane_of[i]] = statuses[i];
+			continue;
+		}
+		results[lane_of[i]] = finishHashChainCheck(timestamps[lane_of[i]],
+				alg_servers[lane_of[i]],
+				hist_outputs + i * GT_HASHCHAIN_MAX_RESULT_LEN,
+				hist_output_lengths[i]);
+	}
+
+	res = GT_OK;
+
+cleanup:
+	if (inputs != NULL) {
+		for (i = 0; i < count; ++i) {
+			ASN1_OCTET_STRING_free(inputs[i]);
+		}
+	}
+	OPENSSL_free(inputs);
+	OPENSSL_free(alg_servers);
+	OPENSSL_free(lane_of);
+	OPENSSL_free(chains);
+	OPENSSL_free(data);
+	OPENSSL_free(data_lengths);
+	OPENSSL_free(loc_outputs);
+	OPENSSL_free(loc_output_lengths);
+	OPENSSL_free(hist_outputs);
+	OPENSSL_free(hist_output_lengths);
+	OPENSSL_free(statuses);
+
+	return res;
+}
+
 /* Helper for performing of the public key signature check. */
 static int checkPublicKeySignature(
 		const GTTimestamp *timestamp, const X509 *certificate)
@@ -2357,21 +2536,18 @@ cleanup:
 
 /**/
 
-int GTTimestamp_verify(const GTTimestamp *timestamp,
-		int parse_data, GTVerificationInfo **verification_info)
+/*
+ * Verification of a timestamp whose hash chain check already gave
+ * \p hash_chain_res.
+ */
+static int verifyTimestamp(const GTTimestamp *timestamp, int parse_data,
+		int hash_chain_res, GTVerificationInfo **verification_info)
 {
 	int res = GT_UNKNOWN_ERROR;
 	int tmp_res;
 	const X509 *certificate = NULL;
 	GTVerificationInfo *tmp_info = NULL;
 
-	if (timestamp == NULL || timestamp->token == NULL ||
-			timestamp->tst_info == NULL || timestamp->time_signature == NULL ||
-			verification_info == NULL) {
-		res = GT_INVALID_ARGUMENT;
-		goto cleanup;
-	}
-
 	/* Create verification info structure with most fields already set to their
 	 * final values. */
 	tmp_res = createVerificationInfo(timestamp, &tmp_info, parse_data);
@@ -2393,7 +2569,7 @@ int GTTimestamp_verify(const GTTimestamp *timestamp,
 	}
 
 	/* Hash Chain Check. */
-	tmp_res = checkHashChain(timestamp);
+	tmp_res = hash_chain_res;
 	switch (tmp_res) {
 	case GT_OK:
 		break;
@@ -2442,6 +2618,74 @@ cleanup:
 	return res;
 }
 
+static int isVerifiable(const GTTimestamp *timestamp)
+{
+	return timestamp != NULL && timestamp->token != NULL &&
+		timestamp->tst_info != NULL && timestamp->time_signature != NULL;
+}
+
+/**/
+
+int GTTimestamp_verify(const GTTimestamp *timestamp,
+		int parse_data, GTVerificationInfo **verification_info)
+{
+	if (!isVerifiable(timestamp) || verification_info == NULL) {
+		return GT_INVALID_ARGUMENT;
+	}
+
+	return verifyTimestamp(timestamp, parse_data, checkHashChain(timestamp),
+			verification_info);
+}
+
+/**/
+
+int GTTimestamp_verifyMany(size_t count,
+		const GTTimestamp *const *timestamps, int parse_data,
+		GTVerificationInfo **verification_infos, int *results)
+{
+	int res = GT_UNKNOWN_ERROR;
+	int *hash_chain_results = NULL;
+	size_t i;
+
+	if (count > 0 && (timestamps == NULL || verification_infos == NULL ||
+				results == NULL)) {
+		res = GT_INVALID_ARGUMENT;
+		goto cleanup;
+	}
+
+	hash_chain_results = OPENSSL_malloc(count * sizeof(int));
+	if (count > 0 && hash_chain_results == NULL) {
+		res = GT_OUT_OF_MEMORY;
+		goto cleanup;
+	}
+	for (i = 0; i < count; ++i) {
+		verification_infos[i] = NULL;
+		hash_chain_results[i] =
+			isVerifiable(timestamps[i]) ? GT_OK : GT_INVALID_ARGUMENT;
+	}
+
+	res = checkHashChains(count, timestamps, hash_chain_results);
+	if (res != GT_OK) {
+		goto cleanup;
+	}
+
+	for (i = 0; i < count; ++i) {
+		if (!isVerifiable(timestamps[i])) {
+			results[i] = GT_INVALID_ARGUMENT;
+			continue;
+		}
+		results[i] = verifyTimestamp(timestamps[i], parse_data,
+				hash_chain_results[i], &verification_infos[i]);
+	}
+
+	res = GT_OK;
+
+cleanup:
+	OPENSSL_free(hash_chain_results);
+
+	return res;
+}
+
 /**/
 
 int GTTimestamp_checkDocumentHash(
@@ -17,6 +17,7 @@
  */
 
 #include "gt_internal.h"
+#include "gt_sha256mb.h"
 #include "hashchain.h"
 
 #include <openssl/crypto.h>
@@ -26,7 +27,9 @@
 #include <assert.h>
 #include <memory.h>
 
-#define MAX_STEP_RESULT_LEN (2 * EVP_MAX_MD_SIZE + 3)
+#ifndef _WIN32
+#include <pthread.h>
+#endif
 
 struct hash_chain_constructor_impl {
 	unsigned char *hash_chain;
@@ -37,22 +40,25 @@ struct hash_chain_constructor_impl {
 
 /* Helper stuff */
 
-/** Context for hash chain calculation. */
+/** Context for walking the steps of a hash chain. */
 typedef struct {
 	const unsigned char *hash_chain;
 	size_t hash_chain_len;
-	unsigned char *result_buf;
-	size_t result_len;
 	size_t current_pos;
-	int current_depth;
-	int strictly_incr_depths;
-	unsigned char input_hash[EVP_MAX_MD_SIZE];
 } HashWalkCtx;
 
+/** Number of hash algorithm IDs, all supported ones are below this. */
+#define HC_HASHALG_COUNT (GT_HASHALG_SHA512 + 1)
+
+/**
+ * Digest contexts, one per hash algorithm. Reusing a context for the same
+ * algorithm skips both the EVP_MD lookup and the allocation of the digest
+ * state that a fresh context does on every EVP_DigestInit().
+ */
 typedef struct {
-	int hash_alg;
-	unsigned char hash[EVP_MAX_MD_SIZE];
-} HCDigest;
+	EVP_MD_CTX *ctx[HC_HASHALG_COUNT];
+	const EVP_MD *md[HC_HASHALG_COUNT];
+} HCDigestSet;
 
 /**/
 
@@ -90,33 +96,165 @@ int GT_isSupportedHashAlgorithm(int hash_id)
  */
 size_t GT_getHashSize(int hash_id)
 {
-	const EVP_MD *evp_md = GT_hashChainIDToEVP(hash_id);
-	if (evp_md == NULL) {
-		return 0;
+	/* Called for every field of every hash step, so not through EVP. */
+	switch (GT_fixHashAlgorithm(hash_id)) {
+#ifndef OPENSSL_NO_SHA
+		case GT_HASHALG_SHA1:
+			return 20;
+#endif
+#ifndef OPENSSL_NO_RIPEMD
+		case GT_HASHALG_RIPEMD160:
+			return 20;
+#endif
+		case GT_HASHALG_SHA224:
+			return 28;
+		case GT_HASHALG_SHA256:
+			return 32;
+#ifndef OPENSSL_NO_SHA512
+		case GT_HASHALG_SHA384:
+			return 48;
+		case GT_HASHALG_SHA512:
+			return 64;
+#endif
+		default:
+			return 0;
+	}
+}
+
+static void HCDigestSetInit(HCDigestSet *set)
+{
+	int i;
+
+	for (i = 0; i < HC_HASHALG_COUNT; ++i) {
+		set->ctx[i] = NULL;
+		set->md[i] = NULL;
+	}
+}
+
+static void HCDigestSetCleanup(HCDigestSet *set)
+{
+	int i;
+
+	for (i = 0; i < HC_HASHALG_COUNT; ++i) {
+		if (set->ctx[i] != NULL) {
+			EVP_MD_CTX_destroy(set->ctx[i]);
+		}
+	}
+}
+
+/**
+ * Calculates digest with the context for \p hash_alg in \p set.
+ * \return GT_OK, or GT_OUT_OF_MEMORY if the context could not be created.
+ */
+static int HCDigestSetDigest(HCDigestSet *set, int hash_alg,
+		const unsigned char *data, size_t data_len, unsigned char *result)
+{
+	EVP_MD_CTX *md_ctx;
+
+	assert(hash_alg >= 0 && hash_alg < HC_HASHALG_COUNT);
+
+	md_ctx = set->ctx[hash_alg];
+	if (md_ctx == NULL) {
+		set->md[hash_alg] = GT_hashChainIDToEVP(hash_alg);
+		assert(set->md[hash_alg] != NULL);
+		md_ctx = EVP_MD_CTX_create();
+		if (md_ctx == NULL) {
+			return GT_OUT_OF_MEMORY;
+		}
+		set->ctx[hash_alg] = md_ctx;
+	}
+
+	/* The _ex variants keep the digest state allocated between uses. */
+	EVP_DigestInit_ex(md_ctx, set->md[hash_alg], NULL);
+	EVP_DigestUpdate(md_ctx, data, data_len);
+	EVP_DigestFinal_ex(md_ctx, result, NULL);
+
+	return GT_OK;
+}
+
+#ifndef _WIN32
+
+/*
+ * Each thread keeps its own digest set, freed when the thread exits.
+ * On Windows there is no per-thread set and the contexts are reused only
+ * within one hash chain calculation.
+ */
+static pthread_key_t digest_set_key;
+static pthread_once_t digest_set_once = PTHREAD_ONCE_INIT;
+static int digest_set_key_created = 0;
+
+static void HCDigestSetFree(void *set)
+{
+	HCDigestSetCleanup(set);
+	OPENSSL_free(set);
+}
+
+static void HCDigestSetCreateKey(void)
+{
+	digest_set_key_created =
+		(pthread_key_create(&digest_set_key, HCDigestSetFree) == 0);
+}
+
+/** \return Digest set of the calling thread, NULL if not available. */
+static HCDigestSet *HCDigestSetGet(void)
+{
+	HCDigestSet *set;
+
+	pthread_once(&digest_set_once, HCDigestSetCreateKey);
+	if (!digest_set_key_created) {
+		return NULL;
+	}
+
+	set = pthread_getspecific(digest_set_key);
+	if (set == NULL) {
+		set = OPENSSL_malloc(sizeof(HCDigestSet));
+		if (set == NULL) {
+			return NULL;
+		}
+		HCDigestSetInit(set);
+		if (pthread_setspecific(digest_set_key, set) != 0) {
+			OPENSSL_free(set);
+			return NULL;
+		}
 	}
 
-	return EVP_MD_size(evp_md);
+	return set;
+}
+
+#else /* _WIN32 */
+
+static HCDigestSet *HCDigestSetGet(void)
+{
+	return NULL;
 }
 
+#endif /* _WIN32 */
+
 /** Calculates digest. */
 void GT_calculateDigest(const unsigned char *data, size_t data_len,
 		unsigned char *result, int hash_alg)
 {
-	EVP_MD_CTX md_ctx;
-	const EVP_MD *evp_md;
-	unsigned int digest_len;
+	HCDigestSet local_set;
+	HCDigestSet *set;
+	int res;
 
 	assert(data != NULL || data_len == 0);
 	assert(result != NULL);
+	assert(GT_isSupportedHashAlgorithm(GT_fixHashAlgorithm(hash_alg)));
 
-	evp_md = GT_hashChainIDToEVP(hash_alg);
-	assert(evp_md != NULL);
+	hash_alg = GT_fixHashAlgorithm(hash_alg);
 
-	EVP_DigestInit(&md_ctx, evp_md);
-	EVP_DigestUpdate(&md_ctx, data, data_len);
-	EVP_DigestFinal(&md_ctx, result, &digest_len);
+	set = HCDigestSetGet();
+	if (set != NULL) {
+		res = HCDigestSetDigest(set, hash_alg, data, data_len, result);
+		assert(res == GT_OK);
+		return;
+	}
 
-	assert(digest_len == GT_getHashSize(hash_alg));
+	HCDigestSetInit(&local_set);
+	res = HCDigestSetDigest(&local_set, hash_alg, data, data_len, result);
+	assert(res == GT_OK);
+	HCDigestSetCleanup(&local_set);
 }
 
 static int getStepSize(int hash_alg)
@@ -169,60 +307,51 @@ static int HashWalkCtxGetStepLength(HashWalkCtx *ctx)
 }
 
 /**
- * Checks whether current step is correct.
+ * Checks whether the step at \p step, with \p remaining bytes of the
+ * hash chain left, is correct.
  * \return GT_OK, if OK, error code, if error.
  */
-static int HashWalkCtxCheckStep(HashWalkCtx *ctx)
+static int checkStep(const unsigned char *step, size_t remaining)
 {
-	int res = GT_UNKNOWN_ERROR;
-
-	assert(ctx != NULL);
-
-	if (ctx->hash_chain_len - ctx->current_pos < 3) {
-		res = GT_INVALID_LINKING_INFO;
+	if (remaining < 3) {
 		/* Hash chain ends unexpectedly (during half step). */
-		goto cleanup;
+		return GT_INVALID_LINKING_INFO;
 	}
 
-	if (HashWalkCtxGetInputIsLeft(ctx) > 1) {
-		res = GT_INVALID_LINKING_INFO;
+	if (step[1] > 1) {
 		/* This byte must be 0 or 1. */
-		goto cleanup;
+		return GT_INVALID_LINKING_INFO;
 	}
 
-	if (!GT_isSupportedHashAlgorithm(HashWalkCtxGetConstHashAlg(ctx))) {
-		res = GT_UNTRUSTED_HASH_ALGORITHM;
-		goto cleanup;
+	if (!GT_isSupportedHashAlgorithm(step[2])) {
+		return GT_UNTRUSTED_HASH_ALGORITHM;
 	}
 
-	if (!GT_isSupportedHashAlgorithm(HashWalkCtxGetInputHashAlg(ctx))) {
-		res = GT_UNTRUSTED_HASH_ALGORITHM;
-		goto cleanup;
+	if (!GT_isSupportedHashAlgorithm(step[0])) {
+		return GT_UNTRUSTED_HASH_ALGORITHM;
 	}
 
-	if (ctx->current_pos + HashWalkCtxGetStepLength(ctx) >
-			ctx->hash_chain_len) {
-		res = GT_INVALID_LINKING_INFO;
+	if ((size_t) getStepSize(step[2]) > remaining) {
 		/* Hash chain ends unexpectedly (during half step). */
-		goto cleanup;
+		return GT_INVALID_LINKING_INFO;
 	}
 
-	res = GT_OK;
-
-cleanup:
-
-	return res;
+	return GT_OK;
 }
 
-/** Frees data in hash chain calculation context */
-static void HashWalkCtxFree(HashWalkCtx *ctx)
+/**
+ * Checks whether current step is correct.
+ * \return GT_OK, if OK, error code, if error.
+ */
+static int HashWalkCtxCheckStep(HashWalkCtx *ctx)
 {
-	if (ctx != NULL) {
-		OPENSSL_free(ctx->result_buf);
-	}
+	assert(ctx != NULL);
+
+	return checkStep(ctx->hash_chain + ctx->current_pos,
+			ctx->hash_chain_len - ctx->current_pos);
 }
 
-/** Initializes hash chain calculation context */
+/** Initializes hash chain walking context */
 static int HashWalkCtxInit(HashWalkCtx *ctx,
 		const unsigned char *hash_chain, size_t hash_chain_length)
 {
@@ -230,39 +359,11 @@ static int HashWalkCtxInit(HashWalkCtx *ctx,
 
 	ctx->hash_chain = hash_chain;
 	ctx->hash_chain_len = hash_chain_length;
-	ctx->result_buf = NULL;
-	ctx->result_len = 0;
 	ctx->current_pos = 0;
-	ctx->current_depth = 0;
-	ctx->strictly_incr_depths = 1;
 
 	return HashWalkCtxCheckStep(ctx);
 }
 
-static int HashWalkCtxInitCalcVars(HashWalkCtx *ctx,
-		const unsigned char *data, size_t data_len)
-{
-	int res = GT_UNKNOWN_ERROR;
-
-	assert(ctx != NULL);
-
-	/* Step result always contains two concatenated hashes. */
-	ctx->result_buf = OPENSSL_malloc(2 * EVP_MAX_MD_SIZE + 3);
-	if (ctx->result_buf == NULL) {
-		res = GT_OUT_OF_MEMORY;
-		goto cleanup;
-	}
-
-	GT_calculateDigest(data, data_len, ctx->input_hash,
-				HashWalkCtxGetInputHashAlg(ctx));
-
-	res = GT_OK;
-
-cleanup:
-
-	return res;
-}
-
 
 static int HashWalkCtxIsLastStep(HashWalkCtx *ctx)
 {
@@ -285,73 +386,6 @@ static int HashWalkCtxNextStep(HashWalkCtx *ctx)
 	return HashWalkCtxCheckStep(ctx);
 }
 
-static int HashStepResultGetCurrentDepth(
-		const unsigned char *hash_step_result,
-		size_t hash_step_result_len)
-{
-  return hash_step_result[hash_step_result_len - 1];
-}
-
-static void HashWalkCtxHashStepResult(HashWalkCtx *ctx)
-{
-	assert(ctx != NULL);
-
-	GT_calculateDigest(ctx->result_buf, ctx->result_len, ctx->input_hash,
-			HashWalkCtxGetInputHashAlg(ctx));
-
-	ctx->current_depth = HashStepResultGetCurrentDepth(ctx->result_buf,
-			ctx->result_len);
-}
-
-static void concatenateArguments(
-		int left_hash_alg, const unsigned char *left_hash,
-		int right_hash_alg, const unsigned char *right_arg,
-		int depth,
-		unsigned char *result_buf, size_t *result_len)
-{
-	unsigned char *right_start, *depth_start;
-
-	assert(left_hash != NULL && right_arg != NULL && result_buf != NULL &&
-			result_len != NULL);
-
-	result_buf[0] = left_hash_alg;
-	memcpy(result_buf + 1, left_hash, GT_getHashSize(left_hash_alg));
-
-	right_start = result_buf + 1 + GT_getHashSize(left_hash_alg);
-	right_start[0] = right_hash_alg;
-	memcpy(right_start + 1, right_arg, GT_getHashSize(right_hash_alg));
-
-	depth_start = right_start + 1 + GT_getHashSize(right_hash_alg);
-	depth_start[0] = depth;
-
-	*result_len = GT_getHashSize(left_hash_alg) +
-		GT_getHashSize(right_hash_alg) + 3;
-}
-
-static void HashWalkCtxPrepareStepResult(HashWalkCtx *ctx)
-{
-	const unsigned char *left_arg, *right_arg;
-	int left_hash_alg, right_hash_alg, depth;
-
-	assert(ctx != NULL);
-
-	if (HashWalkCtxGetInputIsLeft(ctx)) {
-		left_arg = ctx->input_hash;
-		left_hash_alg = HashWalkCtxGetInputHashAlg(ctx);
-		right_arg = HashWalkCtxPeekConstArg(ctx);
-		right_hash_alg = HashWalkCtxGetConstHashAlg(ctx);
-	} else {
-		left_arg = HashWalkCtxPeekConstArg(ctx);
-		left_hash_alg = HashWalkCtxGetConstHashAlg(ctx);
-		right_arg = ctx->input_hash;
-		right_hash_alg = HashWalkCtxGetInputHashAlg(ctx);
-	}
-	depth = HashWalkCtxGetMaxDepth(ctx);
-
-	concatenateArguments(left_hash_alg, left_arg, right_hash_alg, right_arg,
-			depth, ctx->result_buf, &ctx->result_len);
-}
-
 /* Real stuff */
 
 int GT_EVPToHashChainID(const EVP_MD *hash_alg)
@@ -406,6 +440,445 @@ const EVP_MD *GT_hashChainIDToEVP(int hash_id)
 	}
 }
 
+/**
+ * Builds the result of a hash step at \p result: the digest of the input
+ * and the sibling imprint side by side, followed by the depth byte.
+ * \return Length of the step result.
+ */
+static size_t buildStep(unsigned char *result, int input_alg,
+		const unsigned char *input_hash, int input_is_left,
+		const unsigned char *sibling, int depth)
+{
+	size_t input_len = GT_getHashSize(input_alg);
+	size_t sibling_len = GT_getHashSize(sibling[0]) + 1;
+	unsigned char *p = result;
+
+	if (input_is_left) {
+		*p++ = input_alg;
+		memcpy(p, input_hash, input_len);
+		p += input_len;
+		memcpy(p, sibling, sibling_len);
+		p += sibling_len;
+	} else {
+		memcpy(p, sibling, sibling_len);
+		p += sibling_len;
+		*p++ = input_alg;
+		memcpy(p, input_hash, input_len);
+		p += input_len;
+	}
+	*p++ = depth;
+
+	return p - result;
+}
+
+/**/
+
+int GT_hashChainWalk(
+		const unsigned char *hash_chain, size_t hash_chain_length,
+		const unsigned char *data, size_t data_length,
+		unsigned char *result, size_t *result_length,
+		int usedepth)
+{
+	int res = GT_UNKNOWN_ERROR;
+	HCDigestSet local_set;
+	HCDigestSet *set;
+	const unsigned char *step = hash_chain;
+	const unsigned char *end = hash_chain + hash_chain_length;
+	unsigned char input_hash[EVP_MAX_MD_SIZE];
+	int previous_depth = 0;
+	int depth;
+
+	assert(hash_chain != NULL && hash_chain_length != 0);
+	assert(data != NULL && data_length != 0 &&
+			result != NULL && result_length != NULL);
+
+	set = HCDigestSetGet();
+	if (set == NULL) {
+		HCDigestSetInit(&local_set);
+		set = &local_set;
+	}
+
+	res = checkStep(step, end - step);
+	if (res != GT_OK) {
+		goto cleanup;
+	}
+	res = HCDigestSetDigest(set, step[0], data, data_length, input_hash);
+	if (res != GT_OK) {
+		goto cleanup;
+	}
+
+	while (1) {
+		depth = step[3 + GT_getHashSize(step[2])];
+		*result_length = buildStep(result, step[0], input_hash, step[1],
+				step + 2, depth);
+
+		step += getStepSize(step[2]);
+		if (step == end) {
+			break;
+		}
+
+		if (usedepth && previous_depth >= depth) {
+			res = GT_INVALID_LENGTH_BYTES;
+			break;
+		}
+		previous_depth = depth;
+
+		res = checkStep(step, end - step);
+		if (res != GT_OK) {
+			break;
+		}
+		res = HCDigestSetDigest(set, step[0], result, *result_length,
+				input_hash);
+		if (res != GT_OK) {
+			break;
+		}
+	}
+
+cleanup:
+	if (set == &local_set) {
+		HCDigestSetCleanup(&local_set);
+	}
+
+	return res;
+}
+
+/**/
+
+int GT_hashChainCompile(
+		const unsigned char *hash_chain, size_t hash_chain_length,
+		GTHashChain **chain)
+{
+	GTHashChain *tmp_chain;
+	size_t max_steps, pos, sibling_len = 0, i;
+	unsigned char *imprints;
+	int previous_depth;
+
+	assert(hash_chain != NULL || hash_chain_length == 0);
+	assert(chain != NULL);
+
+	/* Steps are at least SHA-1 sized, so this many fit in the chain.
+	 * Everything goes into one block, the imprints copied from the chain
+	 * back to back. */
+	max_steps = hash_chain_length / getStepSize(GT_HASHALG_SHA1) + 1;
+	tmp_chain = OPENSSL_malloc(sizeof(GTHashChain) +
+			max_steps * (sizeof(unsigned char *) + 3) + hash_chain_length);
+	if (tmp_chain == NULL) {
+		return GT_OUT_OF_MEMORY;
+	}
+	tmp_chain->sibling = (const unsigned char **) (tmp_chain + 1);
+	imprints = (unsigned char *) (tmp_chain->sibling + max_steps);
+	tmp_chain->input_alg = imprints + hash_chain_length;
+	tmp_chain->input_is_left = tmp_chain->input_alg + max_steps;
+	tmp_chain->depth = tmp_chain->input_is_left + max_steps;
+	tmp_chain->step_count = 0;
+	tmp_chain->syntax_status = GT_OK;
+
+	for (pos = 0; pos < hash_chain_length; pos += sibling_len + 3) {
+		const unsigned char *step = hash_chain + pos;
+
+		tmp_chain->syntax_status = checkStep(step, hash_chain_length - pos);
+		if (tmp_chain->syntax_status != GT_OK) {
+			break;
+		}
+		i = tmp_chain->step_count++;
+		sibling_len = GT_getHashSize(step[2]) + 1;
+		tmp_chain->input_alg[i] = step[0];
+		tmp_chain->input_is_left[i] = step[1];
+		memcpy(imprints, step + 2, sibling_len);
+		tmp_chain->sibling[i] = imprints;
+		imprints += sibling_len;
+		tmp_chain->depth[i] = step[2 + sibling_len];
+	}
+
+	if (hash_chain_length == 0) {
+		/* Walking an empty chain copies the input, but it does not pass
+		 * the syntax check. */
+		tmp_chain->syntax_status = GT_INVALID_LINKING_INFO;
+		tmp_chain->length_status = GT_INVALID_LINKING_INFO;
+		tmp_chain->walk_status[0] = GT_OK;
+		tmp_chain->walk_status[1] = GT_OK;
+		*chain = tmp_chain;
+		return GT_OK;
+	}
+
+	/* The outcomes below follow GT_checkHashChainLengthConsistent() and
+	 * GT_hashChainWalk() step by step, including which of several problems
+	 * gets reported. Note that a walk does not check the depth of the last
+	 * step, but requires the first one to be above zero. */
+	tmp_chain->length_status = tmp_chain->syntax_status;
+	for (i = 1; i < tmp_chain->step_count; ++i) {
+		if (tmp_chain->depth[i] <= tmp_chain->depth[i - 1]) {
+			tmp_chain->length_status = GT_INVALID_LENGTH_BYTES;
+			break;
+		}
+	}
+
+	tmp_chain->walk_status[0] = tmp_chain->syntax_status;
+	tmp_chain->walk_status[1] = tmp_chain->syntax_status;
+	previous_depth = 0;
+	for (i = 0; i < tmp_chain->step_count; ++i) {
+		if (i + 1 == tmp_chain->step_count &&
+				tmp_chain->syntax_status == GT_OK) {
+			break;
+		}
+		if (previous_depth >= tmp_chain->depth[i]) {
+			tmp_chain->walk_status[1] = GT_INVALID_LENGTH_BYTES;
+			break;
+		}
+		previous_depth = tmp_chain->depth[i];
+	}
+
+	*chain = tmp_chain;
+
+	return GT_OK;
+}
+
+/**/
+
+void GT_hashChainFree(GTHashChain *chain)
+{
+	OPENSSL_free(chain);
+}
+
+/**/
+
+int GT_hashChainRun(const GTHashChain *chain,
+		const unsigned char *data, size_t data_length,
+		unsigned char *result, size_t *result_length,
+		int usedepth)
+{
+	int res = GT_UNKNOWN_ERROR;
+	HCDigestSet local_set;
+	HCDigestSet *set;
+	unsigned char input_hash[EVP_MAX_MD_SIZE];
+	size_t i;
+
+	assert(chain != NULL);
+	assert(data != NULL && data_length != 0 &&
+			result != NULL && result_length != NULL);
+
+	/* Known from the structure alone, no need to hash anything. */
+	res = chain->walk_status[usedepth != 0];
+	if (res != GT_OK) {
+		return res;
+	}
+
+	if (chain->step_count == 0) {
+		/* For empty hash chain, the result is copy of the input. */
+		if (data_length > GT_HASHCHAIN_MAX_RESULT_LEN) {
+			return GT_INVALID_ARGUMENT;
+		}
+		memcpy(result, data, data_length);
+		*result_length = data_length;
+		return GT_OK;
+	}
+
+	set = HCDigestSetGet();
+	if (set == NULL) {
+		HCDigestSetInit(&local_set);
+		set = &local_set;
+	}
+
+	res = HCDigestSetDigest(set, chain->input_alg[0], data, data_length,
+			input_hash);
+	for (i = 0; res == GT_OK; ) {
+		*result_length = buildStep(result, chain->input_alg[i], input_hash,
+				chain->input_is_left[i], chain->sibling[i], chain->depth[i]);
+		if (++i == chain->step_count) {
+			break;
+		}
+		res = HCDigestSetDigest(set, chain->input_alg[i], result,
+				*result_length, input_hash);
+	}
+
+	if (set == &local_set) {
+		HCDigestSetCleanup(&local_set);
+	}
+
+	return res;
+}
+
+/** State of one compiled hash chain being calculated in a batch. */
+typedef struct {
+	const GTHashChain *chain;
+	size_t step;
+	unsigned char *result;
+	size_t result_len;
+	unsigned char input_hash[EVP_MAX_MD_SIZE];
+} HCLane;
+
+/** Chains calculated at once by GT_hashChainRunMany(). */
+#define HC_BATCH_LANES 32
+
+/**
+ * Digests waiting to be calculated for the lanes of a batch. SHA-256 ones
+ * are collected for GT_sha256Many(), the rest done one by one.
+ */
+typedef struct {
+	size_t count;
+	int lane[HC_BATCH_LANES];
+	const unsigned char *data[HC_BATCH_LANES];
+	size_t data_len[HC_BATCH_LANES];
+	unsigned char *result[HC_BATCH_LANES];
+} HCDigestQueue;
+
+/**
+ * Calculates the queued digests. Lanes whose digest failed get their
+ * status set and are marked finished.
+ */
+static void HCDigestQueueRun(HCDigestQueue *queue, HCDigestSet *set,
+		HCLane *lanes, int *statuses, int *finished)
+{
+	HCDigestQueue sha256;
+	const HCLane *lane;
+	size_t i;
+	int alg, res;
+
+	sha256.count = 0;
+	for (i = 0; i < queue->count; ++i) {
+		lane = &lanes[queue->lane[i]];
+		alg = lane->chain->input_alg[lane->step];
+		if (alg == GT_HASHALG_SHA256 && GT_sha256ManyLanes() > 1) {
+			sha256.data[sha256.count] = queue->data[i];
+			sha256.data_len[sha256.count] = queue->data_len[i];
+			sha256.result[sha256.count] = queue->result[i];
+			++sha256.count;
+			continue;
+		}
+		res = HCDigestSetDigest(set, alg, queue->data[i], queue->data_len[i],
+				queue->result[i]);
+		if (res != GT_OK) {
+			statuses[queue->lane[i]] = res;
+			finished[queue->lane[i]] = 1;
+		}
+	}
+
+	GT_sha256Many(sha256.count, sha256.data, sha256.data_len, sha256.result);
+	queue->count = 0;
+}
+
+static void HCDigestQueueAdd(HCDigestQueue *queue, int lane,
+		const unsigned char *data, size_t data_len, unsigned char *result)
+{
+	assert(queue->count < HC_BATCH_LANES);
+
+	queue->lane[queue->count] = lane;
+	queue->data[queue->count] = data;
+	queue->data_len[queue->count] = data_len;
+	queue->result[queue->count] = result;
+	++queue->count;
+}
+
+/* Runs up to HC_BATCH_LANES chains in lockstep. */
+static void runBatch(size_t count, HCDigestSet *set,
+		const GTHashChain *const *chains,
+		const unsigned char *const *data, const size_t *data_lengths,
+		unsigned char *results, size_t *result_lengths, int *statuses,
+		int usedepth)
+{
+	HCLane lanes[HC_BATCH_LANES];
+	int finished[HC_BATCH_LANES];
+	HCDigestQueue queue;
+	HCLane *lane;
+	size_t i, active;
+
+	assert(count <= HC_BATCH_LANES);
+
+	queue.count = 0;
+	for (i = 0; i < count; ++i) {
+		finished[i] = 1;
+		result_lengths[i] = 0;
+		statuses[i] = chains[i]->walk_status[usedepth != 0];
+		if (statuses[i] != GT_OK) {
+			continue;
+		}
+		if (chains[i]->step_count == 0) {
+			/* For empty hash chain, the result is copy of the input. */
+			if (data_lengths[i] > GT_HASHCHAIN_MAX_RESULT_LEN) {
+				statuses[i] = GT_INVALID_ARGUMENT;
+				continue;
+			}
+			memcpy(results + i * GT_HASHCHAIN_MAX_RESULT_LEN, data[i],
+					data_lengths[i]);
+			result_lengths[i] = data_lengths[i];
+			continue;
+		}
+		lane = &lanes[i];
+		lane->chain = chains[i];
+		lane->step = 0;
+		lane->result = results + i * GT_HASHCHAIN_MAX_RESULT_LEN;
+		finished[i] = 0;
+		HCDigestQueueAdd(&queue, i, data[i], data_lengths[i],
+				lane->input_hash);
+	}
+	HCDigestQueueRun(&queue, set, lanes, statuses, finished);
+
+	do {
+		active = 0;
+		for (i = 0; i < count; ++i) {
+			if (finished[i]) {
+				continue;
+			}
+			lane = &lanes[i];
+			lane->result_len = buildStep(lane->result,
+					lane->chain->input_alg[lane->step], lane->input_hash,
+					lane->chain->input_is_left[lane->step],
+					lane->chain->sibling[lane->step],
+					lane->chain->depth[lane->step]);
+			if (++lane->step == lane->chain->step_count) {
+				result_lengths[i] = lane->result_len;
+				finished[i] = 1;
+				continue;
+			}
+			HCDigestQueueAdd(&queue, i, lane->result, lane->result_len,
+					lane->input_hash);
+			++active;
+		}
+		HCDigestQueueRun(&queue, set, lanes, statuses, finished);
+	} while (active > 0);
+}
+
+int GT_hashChainRunMany(size_t count, const GTHashChain *const *chains,
+		const unsigned char *const *data, const size_t *data_lengths,
+		unsigned char *results, size_t *result_lengths, int *statuses,
+		int usedepth)
+{
+	HCDigestSet local_set;
+	HCDigestSet *set;
+	size_t i, n;
+	int res = GT_OK;
+
+	assert(count == 0 || (chains != NULL && data != NULL &&
+				data_lengths != NULL && results != NULL &&
+				result_lengths != NULL && statuses != NULL));
+
+	set = HCDigestSetGet();
+	if (set == NULL) {
+		HCDigestSetInit(&local_set);
+		set = &local_set;
+	}
+
+	for (i = 0; i < count; i += n) {
+		n = count - i;
+		if (n > HC_BATCH_LANES) {
+			n = HC_BATCH_LANES;
+		}
+		runBatch(n, set, chains + i, data + i, data_lengths + i,
+				results + i * GT_HASHCHAIN_MAX_RESULT_LEN,
+				result_lengths + i, statuses + i, usedepth);
+	}
+
+	for (i = 0; i < count && res == GT_OK; ++i) {
+		res = statuses[i];
+	}
+
+	if (set == &local_set) {
+		HCDigestSetCleanup(&local_set);
+	}
+
+	return res;
+}
+
 /**
  * Hash chain calculation.
  *
@@ -434,13 +907,10 @@ static int GT_hashChainCalculateAux(
 		int usedepth)
 {
 	int res = GT_UNKNOWN_ERROR;
-	int rc;
+	unsigned char step_result[GT_HASHCHAIN_MAX_RESULT_LEN];
 	unsigned char *tmp_res = NULL;
 	size_t tmp_res_len;
 
-	HashWalkCtx calc_ctx;
-	int calc_ctx_initialized = 0;
-
 	assert(data != NULL && data_length != 0 &&
 			result != NULL && result_length != NULL);
 
@@ -454,44 +924,18 @@ static int GT_hashChainCalculateAux(
 		memcpy(tmp_res, data, data_length);
 		tmp_res_len = data_length;
 	} else {
-		rc = HashWalkCtxInit(&calc_ctx, hash_chain, hash_chain_length);
-		if (rc != GT_OK) {
-			res = rc;
+		res = GT_hashChainWalk(hash_chain, hash_chain_length,
+				data, data_length, step_result, &tmp_res_len, usedepth);
+		if (res != GT_OK) {
 			goto cleanup;
 		}
-		calc_ctx_initialized = 1;
-		calc_ctx.strictly_incr_depths = usedepth;
 
-		rc = HashWalkCtxInitCalcVars(&calc_ctx, data, data_length);
-		if (rc != GT_OK) {
-			res = rc;
+		tmp_res = OPENSSL_malloc(tmp_res_len);
+		if (tmp_res == NULL) {
+			res = GT_OUT_OF_MEMORY;
 			goto cleanup;
 		}
-
-		while (1) {
-			HashWalkCtxPrepareStepResult(&calc_ctx);
-
-			if (HashWalkCtxIsLastStep(&calc_ctx))
-				break;
-
-			if (calc_ctx.strictly_incr_depths &&
-					(calc_ctx.current_depth >=
-					 HashWalkCtxGetMaxDepth(&calc_ctx))) {
-				res = GT_INVALID_LENGTH_BYTES;
-				goto cleanup;
-			}
-
-			rc = HashWalkCtxNextStep(&calc_ctx);
-			if (rc != GT_OK) {
-				res = rc;
-				goto cleanup;
-			}
-			HashWalkCtxHashStepResult(&calc_ctx);
-		}
-
-		tmp_res = calc_ctx.result_buf;
-		calc_ctx.result_buf = NULL;
-		tmp_res_len = calc_ctx.result_len;
+		memcpy(tmp_res, step_result, tmp_res_len);
 	}
 
 	*result = tmp_res;
@@ -502,9 +946,6 @@ static int GT_hashChainCalculateAux(
 
 cleanup:
 	OPENSSL_free(tmp_res);
-	if (calc_ctx_initialized) {
-		HashWalkCtxFree(&calc_ctx);
-	}
 
 	return res;
 }
@@ -843,13 +1284,10 @@ int GT_checkHashChain(const ASN1_OCTET_STRING *hash_chain)
 	while (!HashWalkCtxIsLastStep(&ctx)) {
 		res = HashWalkCtxNextStep(&ctx);
 		if (res != GT_OK) {
-			HashWalkCtxFree(&ctx);
 			return res;
 		}
 	}
 
-	HashWalkCtxFree(&ctx);
-
 	return GT_OK;
 }
 
@@ -877,21 +1315,17 @@ int GT_checkHashChainLengthConsistent(const ASN1_OCTET_STRING *hash_chain)
 	while (!HashWalkCtxIsLastStep(&ctx)) {
 		res = HashWalkCtxNextStep(&ctx);
 		if (res != GT_OK) {
-			HashWalkCtxFree(&ctx);
 			return res;
 		}
 
 		current_length = HashWalkCtxGetMaxDepth(&ctx);
 		if (current_length <= previous_length) {
-			HashWalkCtxFree(&ctx);
 			return GT_INVALID_LENGTH_BYTES;
 		}
 
 		previous_length = current_length;
 	}
 
-	HashWalkCtxFree(&ctx);
-
 	return GT_OK;
 }
 
@@ -1306,7 +1740,6 @@ int GTHashEntryList_set(
 	int res = GT_UNKNOWN_ERROR;
 	int tmp_res;
 	HashWalkCtx ctx;
-	int ctx_initialized = 0;
 	int i;
 	int tmp_count = 0;
 	GTHashEntry *tmp_list = NULL;
@@ -1334,7 +1767,6 @@ int GTHashEntryList_set(
 		res = tmp_res;
 		goto cleanup;
 	}
-	ctx_initialized = 1;
 
 	i = 0;
 	while (1) {
@@ -1361,9 +1793,6 @@ int GTHashEntryList_set(
 		tmp_list[i].sibling_hash_value = NULL;
 	}
 
-	HashWalkCtxFree(&ctx);
-	ctx_initialized = 0;
-
 	/* Second iteration, fill output values. */
 
 	tmp_res = HashWalkCtxInit(&ctx,
@@ -1373,7 +1802,6 @@ int GTHashEntryList_set(
 		res = tmp_res;
 		goto cleanup;
 	}
-	ctx_initialized = 1;
 
 	i = 0;
 	while (1) {
@@ -1419,9 +1847,6 @@ int GTHashEntryList_set(
 	res = GT_OK;
 
 cleanup:
-	if (ctx_initialized) {
-		HashWalkCtxFree(&ctx);
-	}
 	GTHashEntryList_free(&tmp_count, &tmp_list);
 
 	return res;
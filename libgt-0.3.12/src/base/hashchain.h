@@ -86,6 +86,131 @@ int GT_hashChainCalculateNoDepth(
 		const unsigned char *data, size_t data_length,
 		unsigned char **result, size_t *result_length);
 
+/**
+ * Size of the buffer that can hold the result of any hash step: two
+ * imprints and the depth byte.
+ */
+#define GT_HASHCHAIN_MAX_RESULT_LEN (2 * EVP_MAX_MD_SIZE + 3)
+
+/**
+ * Applies hash chain calculation to given input data like
+ * GT_hashChainCalculate(), but without allocating memory: the result is
+ * written to a buffer supplied by the caller, and the digests are calculated
+ * with contexts kept per thread and reused across calls.
+ *
+ * \param hash_chain \c (in) - Buffer containing hash chain, not empty.
+ * \param hash_chain_length \c (in) - Length of \p hash_chain, in bytes.
+ * \param data input \c (in) - Data for the hash chain calculation.
+ * \param data_length \c (in) - length of \p data, in bytes.
+ * \param result \c (out) - Buffer of at least
+ * \c GT_HASHCHAIN_MAX_RESULT_LEN bytes receiving the result.
+ * \param result_length \c (out) - Pointer to integer that will receive
+ * length of hash chain calculation result \p result.
+ * \param usedepth \c (in) - Whether to check that the depths are strictly
+ * increasing, as GT_hashChainCalculate() does.
+ * \return status code (\c GT_OK, when operation succeeded, otherwise an
+ * error code).
+ */
+int GT_hashChainWalk(
+		const unsigned char *hash_chain, size_t hash_chain_length,
+		const unsigned char *data, size_t data_length,
+		unsigned char *result, size_t *result_length,
+		int usedepth);
+
+/**
+ * Hash chain decoded into separate arrays of the step fields, so that it
+ * can be calculated many times without parsing it again. The outcome of
+ * all checks that depend on the structure alone is found at decoding.
+ */
+typedef struct GTHashChain_st {
+	/** Number of well-formed steps, all of them when \c syntax_status is
+	 * \c GT_OK. */
+	size_t step_count;
+	/** Hash algorithm of the input of each step. */
+	unsigned char *input_alg;
+	/** 1 where the input is the left argument of a step, 0 if right. */
+	unsigned char *input_is_left;
+	/** Sibling (constant argument) imprint of each step: the algorithm ID
+	 * followed by the digest. */
+	const unsigned char **sibling;
+	/** Depth byte of each step. */
+	unsigned char *depth;
+	/** Result of GT_checkHashChain() on the chain. */
+	int syntax_status;
+	/** Result of GT_checkHashChainLengthConsistent() on the chain. */
+	int length_status;
+	/** Result that a walk without (index 0) and with (index 1) the depth check
+	 * would give, unless a digest calculation fails. */
+	int walk_status[2];
+} GTHashChain;
+
+/**
+ * Decodes a hash chain into a \c GTHashChain. A malformed chain is decoded
+ * as well, up to the first bad step, with its problems recorded in the
+ * status fields.
+ *
+ * \param hash_chain \c (in) - Buffer containing hash chain.
+ * \param hash_chain_length \c (in) - Length of \p hash_chain, in bytes.
+ * \param chain \c (out) - Pointer that will receive pointer to the decoded
+ * hash chain.
+ * \return \c GT_OK, or \c GT_OUT_OF_MEMORY.
+ *
+ * \note The caller must free \p chain using GT_hashChainFree().
+ */
+int GT_hashChainCompile(
+		const unsigned char *hash_chain, size_t hash_chain_length,
+		GTHashChain **chain);
+
+/**
+ * Frees a hash chain returned by GT_hashChainCompile().
+ */
+void GT_hashChainFree(GTHashChain *chain);
+
+/**
+ * Applies decoded hash chain to given input data, with the same outcome as
+ * GT_hashChainWalk() on the encoded chain, except that an empty chain gives
+ * a copy of the input, which then must fit the result buffer.
+ *
+ * \param chain \c (in) - Decoded hash chain.
+ * \param data input \c (in) - Data for the hash chain calculation.
+ * \param data_length \c (in) - length of \p data, in bytes.
+ * \param result \c (out) - Buffer of at least
+ * \c GT_HASHCHAIN_MAX_RESULT_LEN bytes receiving the result.
+ * \param result_length \c (out) - Pointer to integer that will receive
+ * length of hash chain calculation result \p result.
+ * \param usedepth \c (in) - As for GT_hashChainWalk().
+ * \return status code (\c GT_OK, when operation succeeded, otherwise an
+ * error code).
+ */
+int GT_hashChainRun(const GTHashChain *chain,
+		const unsigned char *data, size_t data_length,
+		unsigned char *result, size_t *result_length,
+		int usedepth);
+
+/**
+ * Applies GT_hashChainRun() to \p count hash chains, advancing them in
+ * lockstep so that the SHA-256 digests of their steps are calculated
+ * several at a time (see GT_sha256Many()). Meant for verifying many
+ * timestamps at once.
+ *
+ * \param count \c (in) - Number of hash chains.
+ * \param chains \c (in) - Decoded hash chains.
+ * \param data \c (in) - Input data for each hash chain.
+ * \param data_lengths \c (in) - Lengths of the input data, in bytes.
+ * \param results \c (out) - Buffer of \p count times
+ * \c GT_HASHCHAIN_MAX_RESULT_LEN bytes; result \c i is written at offset
+ * \c i * GT_HASHCHAIN_MAX_RESULT_LEN.
+ * \param result_lengths \c (out) - Lengths of the results.
+ * \param statuses \c (out) - Status code of each hash chain calculation.
+ * \param usedepth \c (in) - As for GT_hashChainWalk().
+ * \return \c GT_OK if all hash chains were calculated, otherwise the first
+ * error code in \p statuses.
+ */
+int GT_hashChainRunMany(size_t count, const GTHashChain *const *chains,
+		const unsigned char *const *data, const size_t *data_lengths,
+		unsigned char *results, size_t *result_lengths, int *statuses,
+		int usedepth);
+
 /**
  * Converts hash algorithm ID from EVP_MD to integer value used in
  * hash chain calculations (e.g. GT_ALGID_SHA1).
@@ -0,0 +1,327 @@
+/*
+ * Copyright 2008-2010 GuardTime AS
+ *
+ * This file is part of the GuardTime client SDK.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or
+ * implied. See the License for the specific language governing
+ * permissions and limitations under the License.
+ */
+
+/*
+ * Microbenchmark of hash chain calculation, in hash steps per second.
+ * GT_sha256Many() is checked against OpenSSL first, one message at a time
+ * and, wherever the CPU has AVX2, with the AVX2 kernel. The baseline is the
+ * calculation as done before GT_hashChainWalk(); GT_hashChainCalculate()
+ * is a wrapper of GT_hashChainWalk() now.
+ *
+ * Build and run from this directory:
+ *
+ *     cc -O2 -I../src/base hashchain_bench.c ../src/base/[a-z]*.c -lcrypto \
+ *         -lpthread -o hashchain_bench
+ *     ./hashchain_bench [steps per chain] [chains]
+ */
+
+#include "gt_base.h"
+#include "gt_sha256mb.h"
+#include "hashchain.h"
+
+#include <openssl/crypto.h>
+#include <openssl/evp.h>
+#include <openssl/sha.h>
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+/* Chains per GT_hashChainRunMany() call. */
+#define BATCH 64
+
+/* Messages per GT_sha256Many() call in the known-answer check. */
+#define KAT_COUNT 21
+
+static double now(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+static void report(const char *name, int steps, int chains, double elapsed)
+{
+	printf("%-24s %10.0f steps/s  %8.0f chains/s\n", name,
+			steps * (double) chains / elapsed, chains / elapsed);
+}
+
+/*
+ * Hash chain calculation as GT_hashChainCalculate() did it before
+ * GT_hashChainWalk(): the steps parsed on every call, a fresh digest
+ * context for every step and the result allocated. The chain must be
+ * well-formed.
+ */
+static int baselineCalculate(const unsigned char *chain, size_t chain_len,
+		const unsigned char *data, size_t data_len,
+		unsigned char **result, size_t *result_len)
+{
+	unsigned char input[EVP_MAX_MD_SIZE];
+	unsigned char *buf, *p;
+	const unsigned char *step;
+	size_t pos, input_size, sibling_size;
+
+	buf = OPENSSL_malloc(2 * EVP_MAX_MD_SIZE + 3);
+	if (buf == NULL) {
+		return GT_OUT_OF_MEMORY;
+	}
+
+	p = buf;
+	for (pos = 0; pos < chain_len; pos += sibling_size + 4) {
+		step = chain + pos;
+		input_size = GT_getHashSize(step[0]);
+		sibling_size = GT_getHashSize(step[2]);
+		if (pos == 0) {
+			EVP_Digest(data, data_len, input, NULL,
+					GT_hashChainIDToEVP(step[0]), NULL);
+		} else {
+			if (p[-1] >= step[sibling_size + 3]) {
+				OPENSSL_free(buf);
+				return GT_INVALID_LENGTH_BYTES;
+			}
+			EVP_Digest(buf, p - buf, input, NULL,
+					GT_hashChainIDToEVP(step[0]), NULL);
+		}
+
+		p = buf;
+		if (step[1]) {
+			*p++ = step[0];
+			memcpy(p, input, input_size);
+			p += input_size;
+		}
+		memcpy(p, step + 2, sibling_size + 1);
+		p += sibling_size + 1;
+		if (!step[1]) {
+			*p++ = step[0];
+			memcpy(p, input, input_size);
+			p += input_size;
+		}
+		*p++ = step[sibling_size + 3];
+	}
+
+	*result = buf;
+	*result_len = p - buf;
+	return GT_OK;
+}
+
+/*
+ * Compares GT_sha256Many() to OpenSSL on messages around the block
+ * boundaries, with counts that do and do not fill the lanes, and with
+ * digests written over their messages. Returns the number of mismatches.
+ */
+static int checkSha256Many(void)
+{
+	static const size_t lengths[] = { 0, 1, 3, 31, 32, 33, 55, 56, 63, 64,
+			65, 119, 120, 127, 128, 200, 32, 64, 32, 1000, 32 };
+	unsigned char messages[KAT_COUNT][1000], digests[KAT_COUNT][32];
+	unsigned char expected[KAT_COUNT][32];
+	const unsigned char *data[KAT_COUNT];
+	size_t data_len[KAT_COUNT];
+	unsigned char *result[KAT_COUNT];
+	int count, i, j, failures = 0;
+
+	for (i = 0; i < KAT_COUNT; ++i) {
+		for (j = 0; j < (int) sizeof(messages[i]); ++j) {
+			messages[i][j] = (unsigned char) (i * 31 + j * 7);
+		}
+		data[i] = messages[i];
+		data_len[i] = lengths[i];
+		SHA256(messages[i], lengths[i], expected[i]);
+	}
+
+	for (count = 1; count <= KAT_COUNT; ++count) {
+		for (i = 0; i < count; ++i) {
+			result[i] = digests[i];
+		}
+		GT_sha256Many(count, data, data_len, result);
+		for (i = 0; i < count; ++i) {
+			if (memcmp(digests[i], expected[i], 32) != 0) {
+				fprintf(stderr, "GT_sha256Many: wrong digest of message %d "
+						"(%lu bytes) of %d, %d lanes\n", i,
+						(unsigned long) lengths[i], count, GT_sha256ManyLanes());
+				++failures;
+			}
+		}
+	}
+
+	/* In place, as hash chain steps do. */
+	for (i = 0; i < KAT_COUNT; ++i) {
+		result[i] = messages[i];
+	}
+	GT_sha256Many(KAT_COUNT, data, data_len, result);
+	for (i = 0; i < KAT_COUNT; ++i) {
+		if (memcmp(messages[i], expected[i], 32) != 0) {
+			fprintf(stderr, "GT_sha256Many: wrong digest of message %d "
+					"(%lu bytes) in place, %d lanes\n", i,
+					(unsigned long) lengths[i], GT_sha256ManyLanes());
+			++failures;
+		}
+	}
+
+	return failures;
+}
+
+int main(int argc, char **argv)
+{
+	int steps = argc > 1 ? atoi(argv[1]) : 32;
+	int chains = argc > 2 ? atoi(argv[2]) : 200000;
+	unsigned char sibling[32], data[32];
+	unsigned char result[GT_HASHCHAIN_MAX_RESULT_LEN];
+	unsigned char *chain, *calculated, *batch_results;
+	const GTHashChain *batch_chains[BATCH];
+	const unsigned char *batch_data[BATCH];
+	size_t batch_data_lengths[BATCH];
+	size_t batch_result_lengths[BATCH];
+	int batch_statuses[BATCH];
+	size_t chain_len, result_len, chain_result_len;
+	GTHCConstructor *hc;
+	GTHashChain *compiled;
+	double start;
+	int i, res;
+
+	res = GT_init();
+	if (res != GT_OK) {
+		fprintf(stderr, "GT_init: %s\n", GT_getErrorString(res));
+		return 1;
+	}
+
+	/* A chain shaped like a calendar chain: SHA-256, depths increasing. */
+	res = GTHCConstructor_new(GT_HASHALG_SHA256, steps, &hc);
+	if (res != GT_OK) {
+		fprintf(stderr, "GTHCConstructor_new: %s\n", GT_getErrorString(res));
+		return 1;
+	}
+	for (i = 0; i < steps; ++i) {
+		memset(sibling, i, sizeof(sibling));
+		GTHCConstructor_addStep(hc, GT_HASHALG_SHA256, sibling, i & 1, i + 1);
+	}
+	chain = GTHCConstructor_getHashChain(hc, &chain_len);
+	GTHCConstructor_free(hc);
+	memset(data, 0x5a, sizeof(data));
+	res = GT_hashChainCompile(chain, chain_len, &compiled);
+	if (res != GT_OK) {
+		fprintf(stderr, "GT_hashChainCompile: %s\n", GT_getErrorString(res));
+		return 1;
+	}
+
+	/* The AVX2 kernel is not chosen on CPUs with the SHA extensions, but
+	 * it is checked wherever it can run. */
+	if (GT_sha256ManySetLanes(GT_SHA256MB_MAX_LANES) > 1 &&
+			checkSha256Many() != 0) {
+		return 1;
+	}
+	GT_sha256ManySetLanes(1);
+	if (checkSha256Many() != 0) {
+		return 1;
+	}
+	GT_sha256ManySetLanes(0);
+
+	/* The baseline must agree with the code measured against it. */
+	res = GT_hashChainWalk(chain, chain_len, data, sizeof(data),
+			result, &result_len, 1);
+	if (res != GT_OK || baselineCalculate(chain, chain_len, data,
+			sizeof(data), &calculated, &chain_result_len) != GT_OK ||
+			chain_result_len != result_len ||
+			memcmp(calculated, result, result_len) != 0) {
+		fprintf(stderr, "baseline: result differs from GT_hashChainWalk\n");
+		return 1;
+	}
+	OPENSSL_free(calculated);
+
+	printf("%d steps per chain, %d chains, %d SHA-256 lanes\n", steps, chains,
+			GT_sha256ManyLanes());
+
+	start = now();
+	for (i = 0; i < chains; ++i) {
+		data[0] = i;
+		res = baselineCalculate(chain, chain_len, data, sizeof(data),
+				&calculated, &result_len);
+		if (res != GT_OK) {
+			fprintf(stderr, "baseline: %s\n", GT_getErrorString(res));
+			return 1;
+		}
+		OPENSSL_free(calculated);
+	}
+	report("baseline (before)", steps, chains, now() - start);
+
+	start = now();
+	for (i = 0; i < chains; ++i) {
+		data[0] = i;
+		res = GT_hashChainWalk(chain, chain_len, data, sizeof(data),
+				result, &result_len, 1);
+		if (res != GT_OK) {
+			fprintf(stderr, "GT_hashChainWalk: %s\n", GT_getErrorString(res));
+			return 1;
+		}
+	}
+	report("GT_hashChainWalk", steps, chains, now() - start);
+
+	start = now();
+	for (i = 0; i < chains; ++i) {
+		data[0] = i;
+		res = GT_hashChainCalculate(chain, chain_len, data, sizeof(data),
+				&calculated, &result_len);
+		if (res != GT_OK) {
+			fprintf(stderr, "GT_hashChainCalculate: %s\n",
+					GT_getErrorString(res));
+			return 1;
+		}
+		OPENSSL_free(calculated);
+	}
+	report("GT_hashChainCalculate", steps, chains, now() - start);
+
+	start = now();
+	for (i = 0; i < chains; ++i) {
+		data[0] = i;
+		res = GT_hashChainRun(compiled, data, sizeof(data),
+				result, &result_len, 1);
+		if (res != GT_OK) {
+			fprintf(stderr, "GT_hashChainRun: %s\n", GT_getErrorString(res));
+			return 1;
+		}
+	}
+	report("GT_hashChainRun", steps, chains, now() - start);
+
+	batch_results = OPENSSL_malloc(BATCH * GT_HASHCHAIN_MAX_RESULT_LEN);
+	for (i = 0; i < BATCH; ++i) {
+		batch_chains[i] = compiled;
+		batch_data[i] = data;
+		batch_data_lengths[i] = sizeof(data);
+	}
+	start = now();
+	for (i = 0; i < chains; i += BATCH) {
+		data[0] = i;
+		res = GT_hashChainRunMany(BATCH, batch_chains, batch_data,
+				batch_data_lengths, batch_results, batch_result_lengths,
+				batch_statuses, 1);
+		if (res != GT_OK) {
+			fprintf(stderr, "GT_hashChainRunMany: %s\n",
+					GT_getErrorString(res));
+			return 1;
+		}
+	}
+	report("GT_hashChainRunMany", steps, (chains + BATCH - 1) / BATCH * BATCH,
+			now() - start);
+	OPENSSL_free(batch_results);
+
+	GT_hashChainFree(compiled);
+	OPENSSL_free(chain);
+	GT_finalize();
+
+	return 0;
+}
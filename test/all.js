@@ -41,11 +41,119 @@ describe('GuardTime', function(){
         var now = new Date();
         assert.ok(lastpubdate.getTime() < now.getTime(), "last publication must be older than wall clock time");
         assert.ok(lastpubdate.getTime() + 1000*60*60*24*40 > now.getTime(), "last publication must be no older than 40 days");
+        assert.ok(gt.publications.file instanceof gt.PublicationsFile);
+        assert.equal(gt.publications.file.getLastPublicationTime().getTime(), lastpubdate.getTime());
         done();
       });
     });
   });
 
+  describe('loadPublications() with publicationscache', function(){
+    var fs = require('fs'), path = require('path');
+    var dir = path.join(require('os').tmpdir(), 'gt-pubcache-' + process.pid);
+    var server, requests = [], service = {}, publications = {};
+    // stand-in publications service revalidating with an ETag
+    before(function(done){
+      fs.mkdirSync(dir);
+      Object.keys(gt.service.publications).forEach(function (k) { service[k] = gt.service.publications[k]; });
+      Object.keys(gt.publications).forEach(function (k) { publications[k] = gt.publications[k]; });
+      var data = gt.publications.data;
+      server = require('http').createServer(function (req, res) {
+        requests.push(req.headers['if-none-match'] || null);
+        req.resume();
+        if (req.headers['if-none-match'] === '"v1"') {
+          res.statusCode = 304;
+          return res.end();
+        }
+        res.setHeader('ETag', '"v1"');
+        res.end(data);
+      }).listen(0, '127.0.0.1', function () {
+        gt.conf({publicationsuri: 'http://127.0.0.1:' + server.address().port + '/publications.bin'});
+        done();
+      });
+    });
+    after(function(){
+      server.close();
+      gt.conf({publicationscache: ''});
+      Object.keys(service).forEach(function (k) { gt.service.publications[k] = service[k]; });
+      Object.keys(publications).forEach(function (k) { gt.publications[k] = publications[k]; });
+      ['publications.bin', 'publications.json'].forEach(function (name) {
+        try { fs.unlinkSync(path.join(dir, name)); } catch (e) {}
+      });
+      fs.rmdirSync(dir);
+    });
+    // a restart: the module forgets the file in use and its description
+    var restart = function () {
+      gt.conf({publicationscache: dir});
+      gt.publications.file = null;
+      gt.publications.data = null;
+      gt.publications.updatedat = 0;
+    };
+    // the cache is written in the background
+    var stored = function (callback) {
+      try {
+        var info = JSON.parse(fs.readFileSync(path.join(dir, 'publications.json'), 'utf8'));
+        if (typeof(info.sha256) === 'string' && info.updatedat === gt.publications.updatedat)
+          return callback();
+      } catch (e) {}
+      setTimeout(stored, 10, callback);
+    };
+
+    it('downloads and stores the file on a cold cache', function(done){
+      restart();
+      gt.loadPublications(function (err) {
+        assert.ifError(err);
+        assert.deepEqual(requests, [null]);
+        assert.ok(gt.publications.file instanceof gt.PublicationsFile);
+        stored(done);
+      });
+    });
+
+    it('revalidates the file in use with a conditional request', function(done){
+      gt.loadPublications(function (err) {
+        assert.ifError(err);
+        assert.deepEqual(requests, [null, '"v1"']);
+        assert.ok(gt.publications.file instanceof gt.PublicationsFile);
+        assert.ok(gt.publications.updatedat > 0);
+        stored(done);
+      });
+    });
+
+    it('starts from a warm cache without a download', function(done){
+      restart();
+      gt.loadPublications(function (err) {
+        assert.ifError(err);
+        assert.equal(requests.length, 2);
+        assert.ok(gt.publications.file instanceof gt.PublicationsFile);
+        assert.equal(gt.publications.file.getLastPublicationTime().getTime(), publications.last.getTime());
+        assert.deepEqual(gt.publications.data, publications.data);
+        done();
+      });
+    });
+
+    it('downloads again when the cached file does not verify', function(done){
+      fs.writeFileSync(path.join(dir, 'publications.bin'), 'garbage, not a publications file');
+      restart();
+      gt.loadPublications(function (err) {
+        assert.ifError(err);
+        assert.deepEqual(requests.slice(2), [null]);
+        assert.ok(gt.publications.file instanceof gt.PublicationsFile);
+        stored(done);
+      });
+    });
+
+    it('downloads again when the cache description is corrupt', function(done){
+      fs.writeFileSync(path.join(dir, 'publications.json'), '{"sha256": 42}');
+      restart();
+      gt.loadPublications(function (err) {
+        assert.ifError(err);
+        assert.deepEqual(requests.slice(3), [null]);
+        assert.ok(gt.publications.file instanceof gt.PublicationsFile);
+        stored(done);
+      });
+    });
+  });
+
   describe('sign()', function(){
     it('signs a text string', function(done){
       gt.sign('Hello!', function (err, ts) {
@@ -164,10 +272,58 @@ describe('GuardTime', function(){
         new TimeSignature("blah");
         }, /Invalid format/i
       );
+      var content = old.getContent();
+      var archive = Buffer.concat([content, content]);
+      var second = new TimeSignature(archive, content.length, content.length);
+      assert.equal(second.getRegisteredTime().getTime(), old.getRegisteredTime().getTime());
+      assert.equal(TimeSignature.decodeAll(archive).length, 2);
+      assert.throws(function () {
+        new TimeSignature(archive, content.length, archive.length);
+        }, /TypeError/
+      );
+      var digests = Buffer.concat([
+          crypto.createHash('sha256').update('a').digest(),
+          crypto.createHash('sha256').update('b').digest()]);
+      var requests = TimeSignature.composeRequests(digests, 'sha256');
+      assert.equal(requests.offsets.length, 3);
+      assert.equal(requests.offsets[2], requests.data.length);
+      assert.throws(function () {
+        TimeSignature.composeRequests(digests.slice(1), 'sha256');
+        }, /TypeError/
+      );
+      var disposed = gt.loadSync(testsigfile);
+      assert.throws(function () {
+        disposed.checkPublicationAsync(42, function () {});
+        }, /TypeError/
+      );
+      disposed.dispose(); // not left busy by the rejected call
+      assert.throws(function () {
+        disposed.verify();
+        }, /blank/
+      );
       done();
     });
   });
 
+  describe('TimeSignature.verifyAsync() etc', function(){
+    it('runs verification functions in the thread pool', function(done){
+      old.verifyAsync(function (err, props) {
+        assert.ifError(err);
+        assert.equal(props.verification_status, gt.VER_RES.PUBLIC_KEY_SIGNATURE_PRESENT);
+        var h = crypto.createHash(sig.getHashAlgorithm());
+        h.update('some data');
+        sig.compareHashAsync(h.digest(), sig.getHashAlgorithm(), function (err, res) {
+          assert.ok(err instanceof Error, 'wrong hash was not detected');
+          assert.throws(function () {
+            old.extendAsync(42, function () {});
+            }, /TypeError/
+          );
+          done();
+        });
+      });
+    });
+  });
+
   describe('extend() and verify()', function(){
     it('extends a old signature token, and then verifies it', function(done){
       gt.extend(old, function (err, xold) {
@@ -187,6 +343,200 @@ describe('GuardTime', function(){
     });
   });
 
+  describe('extend()', function(){
+    // responses of the real service kept by earlier tests
+    var forgetresponses = function () {
+      gt.conf({extensioncachesize: 0});
+      gt.conf({extensioncachesize: 1000});
+    };
+
+    it('extends tokens of the same second with one response', function(done){
+      var copies = [gt.loadSync(testsigfile), gt.loadSync(testsigfile), gt.loadSync(testsigfile)];
+      var extended = 0;
+      copies.forEach(function (ts) {
+        gt.extend(ts, function (err, xts) {
+          assert.ifError(err);
+          assert.ok(xts.isExtended());
+          if (++extended == copies.length)
+            done();
+        });
+      });
+    });
+
+    it('does not reuse a response that did not extend the token', function(done){
+      var requests = 0;
+      var server = require('http').createServer(function (req, res) {
+        requests++;
+        req.resume();
+        res.end('try later');
+      }).listen(0, '127.0.0.1', function () {
+        gt.conf({verifieruri: 'http://127.0.0.1:' + server.address().port + '/'});
+        forgetresponses();
+        var ts = gt.loadSync(testsigfile);
+        // the service says 'try later', leaving the token unextended
+        ts.extendAsync = function (data, callback) {
+          setImmediate(callback, null, 0x10b); // GT_NONSTD_EXTEND_LATER
+        };
+        gt.extend(ts, function (err) {
+          assert.ifError(err);
+          gt.extend(ts, function (err) {
+            assert.ifError(err);
+            assert.equal(requests, 2, 'response was reused');
+            gt.conf({verifieruri: newconf.verifieruri});
+            server.close();
+            done();
+          });
+        });
+      });
+    });
+
+    it('does not reuse a response after a newer publication', function(done){
+      var requests = 0;
+      var server = require('http').createServer(function (req, res) {
+        requests++;
+        req.resume();
+        res.end('extended');
+      }).listen(0, '127.0.0.1', function () {
+        gt.conf({verifieruri: 'http://127.0.0.1:' + server.address().port + '/'});
+        forgetresponses();
+        var ts = gt.loadSync(testsigfile), last = gt.publications.last;
+        // the service response extends the token
+        ts.extendAsync = function (data, callback) {
+          setImmediate(callback, null, true);
+        };
+        gt.extend(ts, function (err) {
+          assert.ifError(err);
+          gt.extend(ts, function (err) {
+            assert.ifError(err);
+            assert.equal(requests, 1, 'response was not reused');
+            gt.publications.last = new Date(+last + 35*24*60*60*1000);
+            gt.extend(ts, function (err) {
+              gt.publications.last = last;
+              gt.conf({verifieruri: newconf.verifieruri});
+              server.close();
+              assert.ifError(err);
+              assert.equal(requests, 2, 'response was reused after a newer publication');
+              done();
+            });
+          });
+        });
+      });
+    });
+  });
+
+  describe('verifyBatch()', function(){
+    it('verifies many tokens at once', function(done){
+      var data = require('fs').readFileSync(testdatafile);
+      var good = crypto.createHash(old.getHashAlgorithm()).update(data).digest();
+      var bad = crypto.createHash(old.getHashAlgorithm()).update('tampered').digest();
+      var blob = Buffer.concat([old.getContent(), old.getContent()]);
+      gt.verifyBatch(blob, [good, bad], function (err, statuses) {
+        assert.ifError(err);
+        assert.equal(statuses.length, 2);
+        assert.equal(statuses[0] & gt.VER_RES.PUBLICATION_CHECKED, gt.VER_RES.PUBLICATION_CHECKED);
+        assert.ok(statuses[1] < 0, 'data tampering was not detected');
+        done();
+      });
+    });
+
+    it('rejects Array elements that are not tokens or hashes', function(done){
+      var hash = crypto.createHash(old.getHashAlgorithm()).update('data').digest();
+      gt.verifyBatch([old, 42], [hash, hash], function (err) {
+        assert.ok(err instanceof TypeError);
+        gt.verifyBatch([old], [{length: 32}], function (err) {
+          assert.ok(err instanceof TypeError);
+          done();
+        });
+      });
+    });
+  });
+
+  describe('verifyMany()', function(){
+    it('verifies files and skips them when restarted from the checkpoint', function(done){
+      var checkpoint = require('os').tmpdir() + '/gt-verifymany-' + process.pid + '.json';
+      var items = [{file: testdatafile, token: testsigfile}, {file: __filename, token: testsigfile}];
+      var results = [];
+      gt.verifyMany(items, {checkpoint: checkpoint}, function (err, summary) {
+        assert.ifError(err);
+        assert.equal(summary.verified, 1);
+        assert.equal(summary.failed, 1);
+        assert.ok(!results[0].error);
+        assert.ok(results[0].status & gt.VER_RES.DOCUMENT_HASH_CHECKED);
+        assert.ok(results[1].error, 'data tampering was not detected');
+        gt.verifyMany(items, {checkpoint: checkpoint}, function (err, summary) {
+          assert.ifError(err);
+          assert.equal(summary.skipped, 2);
+          require('fs').unlinkSync(checkpoint);
+          done();
+        });
+      }).on('result', function (result) {
+        results[result.index] = result;
+      });
+    });
+
+    it('tries items that could not be read again when restarted', function(done){
+      var checkpoint = require('os').tmpdir() + '/gt-verifymany-' + process.pid + '.json';
+      var items = [{file: testdatafile, token: testsigfile}, {file: testdatafile, token: testsigfile + '.missing'}];
+      gt.verifyMany(items, {checkpoint: checkpoint}, function (err, summary) {
+        assert.ifError(err);
+        assert.equal(summary.verified, 1);
+        assert.equal(summary.failed, 1);
+        gt.verifyMany(items, {checkpoint: checkpoint}, function (err, summary) {
+          assert.ifError(err);
+          assert.equal(summary.skipped, 1);
+          assert.equal(summary.failed, 1);
+          require('fs').unlinkSync(checkpoint);
+          done();
+        });
+      });
+    });
+
+    it('ignores the checkpoint of other items', function(done){
+      var checkpoint = require('os').tmpdir() + '/gt-verifymany-' + process.pid + '.json';
+      gt.verifyMany([{file: testdatafile, token: testsigfile}], {checkpoint: checkpoint}, function (err, summary) {
+        assert.ifError(err);
+        assert.equal(summary.verified, 1);
+        gt.verifyMany([{file: __filename, token: testsigfile}], {checkpoint: checkpoint}, function (err, summary) {
+          assert.ifError(err);
+          assert.equal(summary.skipped, 0);
+          assert.equal(summary.failed, 1);
+          require('fs').unlinkSync(checkpoint);
+          done();
+        });
+      });
+    });
+
+    it('keeps hashing while tokens are extended', function(done){
+      var items = [];
+      for (var i = 0; i < 6; i++)
+        items.push({file: testdatafile, token: testsigfile});
+      var extend = gt.extend, hashFile = TimeSignature.hashFile, overlapped = false, engine;
+      var sample = function () {
+        var active = engine.stats().active;
+        overlapped = overlapped || (active.extending > 0 && active.hashing > 0);
+      };
+      // slow hashing and a slower Extending service, both should be busy at once
+      TimeSignature.hashFile = function (file, alg, callback) {
+        setTimeout(hashFile, 30, file, alg, callback);
+      };
+      gt.extend = function (ts, callback) {
+        sample();
+        setTimeout(function () {
+          sample();
+          callback(null, ts);
+        }, 100);
+      };
+      engine = gt.verifyMany(items, {hashing: 1, verifying: 1, extending: 1}, function (err, summary) {
+        gt.extend = extend;
+        TimeSignature.hashFile = hashFile;
+        assert.ifError(err);
+        assert.equal(summary.verified, items.length);
+        assert.ok(overlapped, 'one stage at a time');
+        done();
+      });
+    });
+  });
+
   describe('verify()', function(){
     it('verifies old signature token, this includes automatic extending', function(done){
       gt.load(testsigfile, function (err, ts) {
@@ -208,10 +558,53 @@ describe('GuardTime', function(){
       gt.conf(newconf);
       assert.equal(gt.service.signer.method, 'POST');
       assert.equal(gt.service.verifier.agent.maxSockets, newconf.verifierthreads);
+      assert.ok(gt.service.signer.limiter.limit <= newconf.signerthreads);
+      assert.equal(gt.service.verifier.limiter.limit, 1);
       done();
     });
   });
 
+  describe('service limiter', function(){
+    var Limiter = gt.service.signer.limiter.constructor;
+
+    it('grows by one per limit answers while in use', function(){
+      var limiter = new Limiter(4, 8, 10);
+      limiter.adjust(null, 10, true);
+      var limit = limiter.limit;
+      for (var i = 0; i < 5; i++)
+        limiter.adjust(null, 10, true);
+      assert.ok(limiter.limit > limit + 1 && limiter.limit < limit + 2, 'limit ' + limiter.limit);
+      limit = limiter.limit;
+      limiter.adjust(null, 10, false);
+      assert.equal(limiter.limit, limit, 'grew while not in use');
+    });
+
+    it('halves on errors and on slow answers, once per round trip', function(){
+      var limiter = new Limiter(8, 8, 10);
+      limiter.adjust(null, 10, true);
+      limiter.adjust(new Error('overloaded'), 10, true);
+      assert.equal(limiter.limit, 4);
+      limiter.adjust(new Error('overloaded'), 10, true);
+      assert.equal(limiter.limit, 4, 'cut twice in a round trip');
+      limiter.decreasedat = 0;
+      limiter.adjust(null, 10 * 3, true);
+      assert.equal(limiter.limit, 2);
+    });
+
+    it('stays within its bounds', function(){
+      var limiter = new Limiter(16, 4, 10);
+      assert.equal(limiter.limit, 4);
+      for (var i = 0; i < 100; i++)
+        limiter.adjust(null, 10, true);
+      assert.equal(limiter.limit, limiter.max);
+      for (i = 0; i < 10; i++) {
+        limiter.decreasedat = 0;
+        limiter.adjust(new Error('overloaded'), 10, true);
+      }
+      assert.equal(limiter.limit, limiter.min);
+    });
+  });
+
   describe('verifyFile() etc', function(){
     it('test_verifying_old_stuff_with_pub_dl', function(done){
       gt.publications.updatedat = 0;
@@ -235,6 +628,55 @@ describe('GuardTime', function(){
         });
       });
     });
+
+    it('schedules the refresh of a long-lived publications file', function(done){
+      var load = gt.loadPublications, refreshed = false;
+      gt.loadPublications = function (callback) {
+        refreshed = true;
+        callback();
+      };
+      // a year is beyond the longest timer delay
+      gt.conf({publicationslifetime: 60*60*24*365});
+      setTimeout(function () {
+        gt.loadPublications = load;
+        gt.conf({publicationslifetime: newconf.publicationslifetime});
+        assert.ok(!refreshed, 'refreshed right away');
+        done();
+      }, 200);
+    });
+
+    it('does not verify with a file older than publicationsmaxage', function(done){
+      var load = gt.loadPublications, updatedat = gt.publications.updatedat;
+      gt.loadPublications = function (callback) {
+        setImmediate(callback, new Error('publications service is down'));
+      };
+      gt.conf({publicationsmaxage: 60});
+      gt.publications.updatedat = Date.now() - 3600*1000;
+      gt.verifyFile(testdatafile, gt.loadSync(testsigfile), function (err) {
+        gt.loadPublications = load;
+        gt.publications.updatedat = updatedat;
+        gt.conf({publicationsmaxage: 60*60*24*7});
+        assert.ok(err && /down/.test(err.message), 'verified with a stale file');
+        done();
+      });
+    });
+  });
+
+  describe('TimeSignature.hashFile()', function(){
+    it('hashes a file in the thread pool', function(done){
+      var expected = crypto.createHash('sha256')
+          .update(require('fs').readFileSync(testdatafile)).digest('hex');
+      TimeSignature.hashFile(testdatafile, 'sha256', function (err, digest) {
+        assert.ifError(err);
+        assert.equal(digest.toString('hex'), expected);
+        TimeSignature.hashFile(testdatafile + '.missing', function (err, digest) {
+          assert.ok(err instanceof Error, 'missing file was not detected');
+          assert.equal(err.code, 'ENOENT');
+          assert.equal(err.path, testdatafile + '.missing');
+          done();
+        });
+      });
+    });
   });
 
   describe('verifyFile()', function(){
@@ -266,6 +708,39 @@ describe('GuardTime', function(){
     });
   });
 
+  describe('createSigningStream()', function(){
+    it('signs data streamed through it', function(done){
+      var stream = gt.createSigningStream({passthrough: false}, function (err, ts) {
+        assert.ifError(err);
+        assert.ok(ts instanceof TimeSignature);
+        gt.verifyFile(testdatafile, ts, function (err, res) {
+          assert.ifError(err);
+          assert.ok(res & gt.VER_RES.DOCUMENT_HASH_CHECKED);
+          done();
+        });
+      });
+      require('fs').createReadStream(testdatafile).pipe(stream);
+    });
+  });
+
+  describe('signHash()', function(){
+    it('signs the same hash once for concurrent callers', function(done){
+      var hd = crypto.createHash('sha256').update('Hi there, twice').digest();
+      var tokens = [];
+      [hd, hd.toString('binary')].forEach(function (hash) {
+        gt.signHash(hash, 'sha256', function (err, ts) {
+          assert.ifError(err);
+          if (tokens.push(ts) < 2)
+            return;
+          // one request, but a token of its own for each caller
+          assert.ok(tokens[0] !== tokens[1], 'the token object was shared');
+          assert.equal(tokens[0].getContent().toString('hex'), tokens[1].getContent().toString('hex'));
+          done();
+        });
+      });
+    });
+  });
+
   describe('signHash()', function(){
     it('signs a Buffer with sha1 hash', function(done){
       var h = crypto.createHash('sha1');
@@ -280,4 +755,138 @@ describe('GuardTime', function(){
       });
     });
   });
+
+  describe('signHashAggregated()', function(){
+    it('signs several hashes with one request and verifies them', function(done){
+      var hashes = ['one', 'two', 'three'].map(function (data) {
+        return crypto.createHash('sha256').update(data).digest();
+      });
+      var tree = TimeSignature.aggregate(Buffer.concat(hashes), 'sha256');
+      assert.equal(tree.chains.length, hashes.length);
+      var signed = 0, verified = 0;
+      hashes.forEach(function (hash, i) {
+        gt.signHashAggregated(hash, 'sha256', function (err, ts, chain) {
+          assert.ifError(err);
+          assert.ok(ts instanceof TimeSignature);
+          assert.equal(chain.toString('hex'), tree.chains[i].toString('hex'));
+          if (++signed < hashes.length)
+            return;
+          assert.ok(ts.compareHash(tree.root, 'sha256'));
+          gt.verifyAggregated(hashes[0], 'sha256', ts, chain, function (err) {
+            assert.ok(err, 'hash verified with the chain of another hash');
+            gt.verifyAggregated(hashes[0].slice(0, 20), 'sha256', ts, tree.chains[0], function (err) {
+              assert.ok(err, 'hash of the wrong length accepted');
+              var sha1 = crypto.createHash('sha1').update('one').digest();
+              gt.verifyAggregated(sha1, 'sha1', ts, tree.chains[0], function (err) {
+                assert.ok(err, 'algorithm ignored with a chain');
+                verifyall();
+              });
+            });
+          });
+          function verifyall() {
+            hashes.forEach(function (hash, i) {
+              gt.verifyAggregated(hash, 'sha256', ts, tree.chains[i], function (err, res) {
+                assert.ifError(err);
+                assert.ok(res & gt.VER_RES.DOCUMENT_HASH_CHECKED);
+                if (++verified == hashes.length)
+                  done();
+              });
+            });
+          }
+        });
+      });
+    });
+
+    it('gives every caller a token of its own', function(done){
+      var hashes = ['four', 'five'].map(function (data) {
+        return crypto.createHash('sha256').update(data).digest();
+      });
+      var signed = [];
+      hashes.forEach(function (hash, i) {
+        gt.signHashAggregated(hash, 'sha256', function (err, ts, chain) {
+          assert.ifError(err);
+          signed[i] = {ts: ts, chain: chain};
+          if (!signed[0] || !signed[1])
+            return;
+          assert.ok(signed[0].ts !== signed[1].ts, 'the token object was shared');
+          // one caller done with its token does not affect the other
+          signed[0].ts.dispose();
+          gt.verifyAggregated(hashes[1], 'sha256', signed[1].ts, signed[1].chain, function (err, res) {
+            assert.ifError(err);
+            assert.ok(res & gt.VER_RES.DOCUMENT_HASH_CHECKED);
+            done();
+          });
+        });
+      });
+    });
+  });
+
+  describe('hedged requests', function(){
+    var http = require('http'), servers = {}, hits = {};
+    var uri = function (name) {
+      return 'http://127.0.0.1:' + servers[name].address().port + '/';
+    };
+    // stand-in signing services answering with garbage after a delay
+    before(function(done){
+      var delays = {slow: 3000, fast: 10, failing: 0}, started = 0;
+      Object.keys(delays).forEach(function (name) {
+        servers[name] = http.createServer(function (req, res) {
+          hits[name] = (hits[name] || 0) + 1;
+          req.resume();
+          setTimeout(function () {
+            res.statusCode = name === 'failing' ? 503 : 200;
+            res.end('not a response');
+          }, delays[name]);
+        }).listen(0, '127.0.0.1', function () {
+          if (++started == 3)
+            done();
+        });
+      });
+    });
+    after(function(){
+      gt.conf({signeruri: newconf.signeruri, hedgedelay: 1000, requesttimeout: 0});
+      Object.keys(servers).forEach(function (name) { servers[name].close(); });
+    });
+
+    it('asks another endpoint when the first is slow', function(done){
+      gt.conf({signeruri: [uri('slow'), uri('fast')], hedgedelay: 100});
+      var answered = 0, start = Date.now();
+      hits = {};
+      // endpoints are taken in turn, so one of the two requests starts with the
+      // slow one; distinct hashes, as requests for the same hash are shared
+      ['hedge 1', 'hedge 2'].forEach(function (text) {
+        gt.signHash(crypto.createHash('sha256').update(text).digest(), 'sha256', function (err) {
+          assert.ok(err && !/Service/.test(err.message), 'expected the answer of the fast endpoint');
+          assert.ok(Date.now() - start < 1000);
+          if (++answered < 2)
+            return;
+          assert.equal(hits.slow, 1, 'the slow endpoint was not asked');
+          assert.equal(hits.fast, 2, 'the slow endpoint was not raced');
+          done();
+        });
+      });
+    });
+
+    it('fails over to another endpoint on errors', function(done){
+      gt.conf({signeruri: [uri('failing'), uri('fast')]});
+      var hash = crypto.createHash('sha256').update('failover').digest(), answered = 0;
+      [0, 1].forEach(function () {
+        gt.signHash(hash, 'sha256', function (err) {
+          assert.ok(err && !/Service/.test(err.message), 'expected the answer of the working endpoint');
+          if (++answered == 2)
+            done();
+        });
+      });
+    });
+
+    it('honors the request timeout', function(done){
+      gt.conf({signeruri: uri('slow'), requesttimeout: 200});
+      var start = Date.now();
+      gt.signHash(crypto.createHash('sha256').update('deadline').digest(), 'sha256', function (err) {
+        assert.ok(err && /no answer/.test(err.message));
+        assert.ok(Date.now() - start < 1000);
+        done();
+      });
+    });
+  });
 });
@@ -22,10 +22,18 @@
 
 #include <nan.h>
 #include <string>
+#include <cerrno>
 
 #include <openssl/crypto.h>
+#include <openssl/evp.h>
 #include <openssl/opensslv.h>
 
+#ifndef PREINSTALLED_LIBGT
+// internal to libgt, only available with the bundled copy
+#include <hashchain.h>
+#include <vector>
+#endif
+
 #if !(defined OPENSSL_CA_FILE || defined OPENSSL_CA_DIR || defined PREINSTALLED_LIBGT)
   const char* root_certs[] = {
     "-----BEGIN CERTIFICATE-----\n"
@@ -58,22 +66,23 @@
 #endif
 
 
-// from node_crypo.cc
+// from node_crypo.cc; typed arrays are accepted as well
 #define ASSERT_IS_STRING_OR_BUFFER(val) \
-  if (!val->IsString() && !Buffer::HasInstance(val)) { \
+  if (!BinaryInput::IsBinary(val)) { \
     return NanThrowTypeError("Not a string or buffer"); \
   }
 
+#define DECODE_BINARY(input, val) \
+  BinaryInput input; \
+  if (!input.Set(val)) { \
+    return NanThrowTypeError("Bad argument"); \
+  }
+
 #define ASSERT_IS_N_ARGS(val) \
   if (args.Length() != (val)) { \
     return NanThrowTypeError("Wrong number of arguments"); \
   }
 
-#define ASSERT_IS_POSITIVE(val) \
-  if ((val) < 0) { \
-    return NanThrowTypeError("Bad argument"); \
-  }
-
 #define UNWRAP_ts() \
   TimeSignature* ts = ObjectWrap::Unwrap<TimeSignature>(args.This()); \
   if (ts->timestamp == NULL) { \
@@ -85,15 +94,343 @@
     return NanThrowError(GT_getErrorString(res)); \
   }
 
+#define ASSERT_IS_CALLBACK(val) \
+  if (!(val)->IsFunction()) { \
+    return NanThrowTypeError("Last argument must be a callback function"); \
+  }
+
+#define ASSERT_NOT_BUSY(ts) \
+  if ((ts)->pending > 0) { \
+    return NanThrowError("TimeSignature is busy with an asynchronous operation"); \
+  }
+
+// not a libgt status code; signals verification_errors != GT_NO_FAILURES
+#define TS_VERIFICATION_FAILURE (-1)
+
+// decoded ASN.1 structures of a timestamp take a few times its DER size
+#define TS_MEMORY_PER_DER_BYTE 4
+
 
 using namespace node;
 using namespace v8;
 
 
+static const char *error_string(int res)
+{
+  if (res == TS_VERIFICATION_FAILURE)
+    return "TimeSignature verification error";
+  return GT_getErrorString(res);
+}
+
+
+// Length of the DER encoded object at the start of data, including the
+// identifier and length octets; 0 if it is malformed or truncated.
+static size_t der_object_length(const unsigned char *data, size_t len)
+{
+  if (len < 2)
+    return 0;
+  size_t header = 2;
+  size_t content = data[1];
+  if (content & 0x80) {
+    size_t n = content & 0x7f;
+    if (n == 0 || n > 4 || len < 2 + n)
+      return 0;
+    content = 0;
+    for (size_t i = 0; i < n; i++)
+      content = (content << 8) | data[2 + i];
+    header += n;
+  }
+  if (content > len - header)
+    return 0;
+  return header + content;
+}
+
+
+static void free_gt_data(char *data, void *hint)
+{
+  GT_free(data);
+}
+
+// wraps memory allocated by libgt into a Buffer without copying; it is
+// released with GT_free() when the Buffer is collected
+static Local<Object> gt_data_as_Buffer(unsigned char *data, size_t length)
+{
+  return NanNewBufferHandle((char *) data, length, free_gt_data, NULL);
+}
+
+
+#ifndef PREINSTALLED_LIBGT
+// Local aggregation of document digests into a Merkle tree. The links from a
+// leaf to the root use the libgt hash chain format, so the root is computed
+// from a leaf digest with GT_hashChainWalk() like a location chain:
+// a leaf is the hash of the digest, a parent the hash of
+// alg || left || alg || right || depth, depth being its level in the tree.
+
+static void aggregate_node(int alg, const unsigned char *left,
+    const unsigned char *right, int depth, unsigned char *result)
+{
+  size_t size = GT_getHashSize(alg);
+  unsigned char step[2 * EVP_MAX_MD_SIZE + 3];
+  step[0] = alg;
+  memcpy(step + 1, left, size);
+  step[size + 1] = alg;
+  memcpy(step + size + 2, right, size);
+  step[2 * size + 2] = depth;
+  GT_calculateDigest(step, 2 * size + 3, result, alg);
+}
+
+// root of an aggregation tree from a leaf digest and its hash chain;
+// an empty chain links a digest that was aggregated alone to itself.
+// 'algorithm' is that of the leaf digest, and on return that of the root.
+static int chain_root(const unsigned char *chain, size_t chain_length,
+    const unsigned char *digest, size_t digest_length,
+    int *algorithm, unsigned char *root, size_t *root_length)
+{
+  if (chain_length == 0) {
+    if (digest_length > EVP_MAX_MD_SIZE)
+      return GT_INVALID_LINKING_INFO;
+    memcpy(root, digest, digest_length);
+    *root_length = digest_length;
+    return GT_OK;
+  }
+  // the leaves were hashed with the algorithm of the digests
+  if (chain[0] != *algorithm)
+    return GT_INVALID_LINKING_INFO;
+  unsigned char step_result[GT_HASHCHAIN_MAX_RESULT_LEN];
+  size_t step_result_length;
+  int res = GT_hashChainWalk(chain, chain_length, digest, digest_length,
+      step_result, &step_result_length, 1);
+  if (res != GT_OK)
+    return res;
+  // the chain is valid by now; the last step's input algorithm hashes the root
+  size_t pos = 0, step_length;
+  while (pos + (step_length = GT_getHashSize(chain[pos + 2]) + 4) < chain_length)
+    pos += step_length;
+  *algorithm = chain[pos];
+  *root_length = GT_getHashSize(*algorithm);
+  GT_calculateDigest(step_result, step_result_length, root, *algorithm);
+  return GT_OK;
+}
+#endif
+
+
+// Binary argument. Buffer and typed array contents are referenced in place
+// (asynchronous workers keep the object alive with SaveToPersistent),
+// binary strings are decoded into a private copy.
+class BinaryInput
+{
+public:
+  char *data;
+  size_t length;
+
+  BinaryInput() : data(NULL), length(0), owned(false) {}
+
+  ~BinaryInput()
+  {
+    if (owned)
+      delete [] data;
+  }
+
+  // refers to a part of another input, eg. one of concatenated tokens
+  void Refer(char *d, size_t len)
+  {
+    data = d;
+    length = len;
+  }
+
+  static bool IsBinary(Handle<Value> val)
+  {
+    return val->IsString() || Buffer::HasInstance(val) ||
+        (val->IsObject() && val->ToObject()->HasIndexedPropertiesInExternalArrayData());
+  }
+
+  bool Set(Handle<Value> val)
+  {
+    if (Buffer::HasInstance(val)) {
+      Local<Object> buffer_obj = val->ToObject();
+      data = Buffer::Data(buffer_obj);
+      length = Buffer::Length(buffer_obj);
+      return true;
+    }
+    if (val->IsObject() && val->ToObject()->HasIndexedPropertiesInExternalArrayData()) {
+      Local<Object> array_obj = val->ToObject();
+      data = (char *) array_obj->GetIndexedPropertiesExternalArrayData();
+      length = array_obj->Get(NanNew<String>("byteLength"))->Uint32Value();
+      return true;
+    }
+    if (!val->IsString())
+      return false;
+    ssize_t len = DecodeBytes(val, BINARY);
+    if (len < 0)
+      return false;
+    data = new char[len];
+    owned = true;
+    ssize_t written = DecodeWrite(data, len, val, BINARY);
+    assert(written == len);
+    length = len;
+    return true;
+  }
+
+private:
+  bool owned;
+};
+
+
+// Decoded and verified publications file, created once and then used for
+// publication checks of any number of tokens without decoding it again.
+class PublicationsFile: public ObjectWrap
+{
+public:
+  GTPublicationsFile *publications;
+  double last_publication_time;
+
+  static Persistent<FunctionTemplate> constructor_template;
+
+  static void Init(Handle<Object> target)
+  {
+    NanScope();
+
+    Local<FunctionTemplate> t = NanNew<FunctionTemplate>(New);
+    NanAssignPersistent(constructor_template, t);
+    t->InstanceTemplate()->SetInternalFieldCount(1);
+    t->SetClassName(NanNew<String>("PublicationsFile"));
+
+    NODE_SET_PROTOTYPE_METHOD(t, "getLastPublicationTime", GetLastPublicationTime);
+
+    target->Set(NanNew("PublicationsFile"), t->GetFunction());
+  }
+
+  PublicationsFile(GTPublicationsFile *pub, double last)
+  {
+    publications = pub;
+    last_publication_time = last;
+  }
+
+  ~PublicationsFile()
+  {
+    GTPublicationsFile_free(publications);
+  }
+
+  // decodes and verifies publications file; safe to call off the main thread
+  static int load(const char *data, size_t length, GTPublicationsFile **publications,
+        double *last_publication_time)
+  {
+    GTPublicationsFile *pub;
+    GTPubFileVerificationInfo *vi;
+    int res = GTPublicationsFile_DERDecode(data, length, &pub);
+    if (res != GT_OK)
+      return res;
+    res = GTPublicationsFile_verify(pub, &vi);
+    if (res != GT_OK) {
+      GTPublicationsFile_free(pub);
+      return res;
+    }
+    *last_publication_time = vi->last_publication_time;
+    GTPubFileVerificationInfo_free(vi);
+    *publications = pub;
+    return GT_OK;
+  }
+
+  // wraps a publications file loaded off the main thread
+  static Local<Object> NewInstance(GTPublicationsFile *pub, double last)
+  {
+    Local<Object> obj = NanNew(constructor_template)->InstanceTemplate()->NewInstance();
+    PublicationsFile *pf = new PublicationsFile(pub, last);
+    pf->Wrap(obj);
+    return obj;
+  }
+
+  static bool HasInstance(Handle<Value> val) {
+    if (!val->IsObject()) return false;
+    Local<Object> obj = val->ToObject();
+    return NanHasInstance(constructor_template, obj);
+  }
+
+  static NAN_METHOD(New)
+  {
+    NanScope();
+
+    if (!args.IsConstructCall())
+      return NanThrowError("Please use 'new' to instantiate a PublicationsFile class");
+
+    ASSERT_IS_N_ARGS(1);
+    ASSERT_IS_STRING_OR_BUFFER(args[0]);
+
+    BinaryInput input;
+    if (!input.Set(args[0]))
+      return NanThrowTypeError("Bad argument");
+
+    GTPublicationsFile *pub;
+    double last;
+    int res = load(input.data, input.length, &pub, &last);
+    ASSERT_GT_ERROR(res);
+
+    PublicationsFile *pf = new PublicationsFile(pub, last);
+    pf->Wrap(args.This());
+    NanReturnValue(args.This());
+  }
+
+  static NAN_METHOD(GetLastPublicationTime)
+  {
+    NanScope();
+    PublicationsFile *pf = ObjectWrap::Unwrap<PublicationsFile>(args.This());
+    NanReturnValue(NODE_UNIXTIME_V8(pf->last_publication_time));
+  }
+};
+
+Persistent<FunctionTemplate> PublicationsFile::constructor_template;
+
+
+// Reference counted verification result, shared by the TimeSignature that
+// memoizes it and the workers using it meanwhile. Main thread only.
+class SharedVerificationInfo
+{
+public:
+  GTVerificationInfo *info;
+
+  SharedVerificationInfo(GTVerificationInfo *info) : info(info), refs(1) {}
+
+  void Ref()
+  {
+    refs++;
+  }
+
+  void Unref()
+  {
+    if (--refs == 0)
+      delete this;
+  }
+
+private:
+  int refs;
+
+  ~SharedVerificationInfo()
+  {
+    GTVerificationInfo_free(info);
+  }
+};
+
+
 class TimeSignature: public ObjectWrap
 {
+  friend class TimeSignatureWorker;
+  friend class VerifyWorker;
+  friend class DocumentWorker;
+  friend class ExtendWorker;
+
 private:
   GTTimestamp *timestamp;
+  // number of queued asynchronous operations reading the timestamp
+  int pending;
+  // timestamp replaced by extendAsync() while still in use by other workers
+  GTTimestamp *retired_timestamp;
+  // memoized verify_timestamp() result of the current timestamp, NULL
+  // until needed; verification_parsed if verified with parse_data
+  SharedVerificationInfo *verification_info;
+  bool verification_parsed;
+  // DER size of the timestamp and the native memory reported to V8 for it
+  size_t der_length;
+  int external_memory;
 
 public:
   static Persistent<FunctionTemplate> constructor_template;
@@ -118,10 +455,27 @@ public:
     NODE_SET_PROTOTYPE_METHOD(t, "extend", Extend);
     NODE_SET_PROTOTYPE_METHOD(t, "isEarlierThan", IsEarlierThan);
     NODE_SET_PROTOTYPE_METHOD(t, "getRegisteredTime", GetRegisteredTime);
+    NODE_SET_PROTOTYPE_METHOD(t, "dispose", Dispose);
+
+    NODE_SET_PROTOTYPE_METHOD(t, "verifyAsync", VerifyAsync);
+    NODE_SET_PROTOTYPE_METHOD(t, "compareHashAsync", CompareHashAsync);
+    NODE_SET_PROTOTYPE_METHOD(t, "checkPublicationAsync", CheckPublicationAsync);
+    NODE_SET_PROTOTYPE_METHOD(t, "extendAsync", ExtendAsync);
+    NODE_SET_PROTOTYPE_METHOD(t, "verifyDocument", VerifyDocument);
+    NODE_SET_PROTOTYPE_METHOD(t, "verifyAggregated", VerifyAggregated);
 
     NODE_SET_METHOD(t, "composeRequest", ComposeRequest);
+    NODE_SET_METHOD(t, "composeRequests", ComposeRequests);
+    NODE_SET_METHOD(t, "aggregate", Aggregate);
     NODE_SET_METHOD(t, "processResponse", ProcessResponse);
     NODE_SET_METHOD(t, "verifyPublications", VerifyPublications);
+    NODE_SET_METHOD(t, "processResponseAsync", ProcessResponseAsync);
+    NODE_SET_METHOD(t, "fromResponse", FromResponse);
+    NODE_SET_METHOD(t, "fromResponseAsync", FromResponseAsync);
+    NODE_SET_METHOD(t, "verifyPublicationsAsync", VerifyPublicationsAsync);
+    NODE_SET_METHOD(t, "verifyBatch", VerifyBatch);
+    NODE_SET_METHOD(t, "hashFile", HashFile);
+    NODE_SET_METHOD(t, "decodeAll", DecodeAll);
 
     target->Set(NanNew("TimeSignature"), t->GetFunction());
   }
@@ -129,17 +483,115 @@ public:
   TimeSignature()
   {
     timestamp = NULL;
+    pending = 0;
+    retired_timestamp = NULL;
+    verification_info = NULL;
+    verification_parsed = false;
+    der_length = 0;
+    external_memory = 0;
   }
 
-  TimeSignature(GTTimestamp *ts)
+  TimeSignature(GTTimestamp *ts, size_t length)
   {
     timestamp = ts;
+    pending = 0;
+    retired_timestamp = NULL;
+    verification_info = NULL;
+    verification_parsed = false;
+    der_length = length;
+    external_memory = 0;
+    update_external_memory();
   }
 
   ~TimeSignature()
+  {
+    release();
+  }
+
+  // frees the timestamp, leaving the object blank
+  void release()
   {
     if(timestamp != NULL)
       GTTimestamp_free(timestamp);
+    timestamp = NULL;
+    if(retired_timestamp != NULL)
+      GTTimestamp_free(retired_timestamp);
+    retired_timestamp = NULL;
+    if(verification_info != NULL)
+      verification_info->Unref();
+    verification_info = NULL;
+    verification_parsed = false;
+    der_length = 0;
+    update_external_memory();
+  }
+
+  // lets V8 account for the native memory when scheduling GC
+  void update_external_memory()
+  {
+    int size = (int) (der_length * TS_MEMORY_PER_DER_BYTE);
+    if (size != external_memory)
+      NanAdjustExternalMemory(size - external_memory);
+    external_memory = size;
+  }
+
+  // verification result of the timestamp, computed on first use; the
+  // fields of the signed data are parsed only for callers asking for them
+  int get_verification_info(const GTVerificationInfo **vi, int parse_data)
+  {
+    if (verification_info == NULL || (parse_data && !verification_parsed)) {
+      GTVerificationInfo *info;
+      int res = verify_timestamp(timestamp, parse_data, &info);
+      if (res != GT_OK)
+        return res;
+      if (verification_info != NULL)
+        verification_info->Unref();
+      verification_info = new SharedVerificationInfo(info);
+      verification_parsed = parse_data != 0;
+    }
+    *vi = verification_info->info;
+    return GT_OK;
+  }
+
+  // check_publication() of own timestamp, using the memoized verification result
+  int check_publication(const GTPublicationsFile *pub)
+  {
+    const GTVerificationInfo *vi = NULL;
+    if (GTTimestamp_isExtended(timestamp) == GT_NOT_EXTENDED) {
+      int res = get_verification_info(&vi, 0);
+      if (res != GT_OK)
+        return res;
+    }
+    return check_publication(timestamp, pub, vi);
+  }
+
+  // DER size of a timestamp, for the memory reported to V8; 'estimate'
+  // if it cannot be encoded. Safe to call off the main thread.
+  static size_t der_size(const GTTimestamp *timestamp, size_t estimate)
+  {
+    unsigned char *data;
+    size_t data_length;
+    if (GTTimestamp_getDEREncoded(timestamp, &data, &data_length) != GT_OK)
+      return estimate;
+    GT_free(data);
+    return data_length;
+  }
+
+  // installs the extended timestamp of 'length' DER bytes; memoized
+  // verification result is dropped as it describes the old one
+  void replace_timestamp(GTTimestamp *new_ts, size_t length)
+  {
+    // readers queued after extendAsync() may still be using the old timestamp
+    if (pending > 0)
+      retired_timestamp = timestamp;
+    else
+      GTTimestamp_free(timestamp);
+    timestamp = new_ts;
+    if (verification_info != NULL)
+      verification_info->Unref();
+    verification_info = NULL;
+    verification_parsed = false;
+    der_length = length;
+    update_external_memory();
   }
 
   static NAN_METHOD(New)
@@ -151,31 +603,84 @@ public:
     if (!args.IsConstructCall())
       return NanThrowError("Please use 'new' to instantiate a TimeSignature class");
 
-    ASSERT_IS_N_ARGS(1);
+    // new TimeSignature(data, [offset, length])
+    if (args.Length() != 1 && args.Length() != 3) {
+      return NanThrowTypeError("Wrong number of arguments");
+    }
     ASSERT_IS_STRING_OR_BUFFER(args[0]);
+    DECODE_BINARY(input, args[0]);
 
-    ssize_t len = DecodeBytes(args[0], BINARY);
-    ASSERT_IS_POSITIVE(len);
-    if (Buffer::HasInstance(args[0])) {
-      Local<Object> buffer_obj = args[0]->ToObject();
-      char *buffer_data = Buffer::Data(buffer_obj);
-      size_t buffer_length = Buffer::Length(buffer_obj);
-      res = GTTimestamp_DERDecode(buffer_data, buffer_length, &timestamp);
-    } else {
-      char* buf = new char[len];
-      ssize_t written = DecodeWrite(buf, len, args[0], BINARY);
-      assert(written == len);
-      res = GTTimestamp_DERDecode(buf, len, &timestamp);
-      delete [] buf;
+    size_t offset = 0, length = input.length;
+    if (args.Length() == 3 && !get_range(args[1], args[2], input.length, &offset, &length)) {
+      return NanThrowTypeError("Bad offset or length");
     }
+
+    res = GTTimestamp_DERDecode(input.data + offset, length, &timestamp);
     ASSERT_GT_ERROR(res);
 
-    TimeSignature *ts = new TimeSignature(timestamp);
+    TimeSignature *ts = new TimeSignature(timestamp, length);
 
     ts->Wrap(args.This());
     NanReturnValue(args.This());
   }
 
+  // wraps a timestamp created natively, without a call to the constructor
+  static Local<Object> NewInstance(GTTimestamp *timestamp, size_t der_length)
+  {
+    Local<Object> obj = NanNew(constructor_template)->InstanceTemplate()->NewInstance();
+    TimeSignature *ts = new TimeSignature(timestamp, der_length);
+    ts->Wrap(obj);
+    return obj;
+  }
+
+  // validates optional (offset, length) arguments against the data size
+  static bool get_range(Handle<Value> offset_val, Handle<Value> length_val, size_t total,
+        size_t *offset, size_t *length)
+  {
+    if (!offset_val->IsNumber() || !length_val->IsNumber())
+      return false;
+    double o = offset_val->NumberValue(), l = length_val->NumberValue();
+    if (!(o >= 0 && l >= 0 && o + l <= total) || o != (size_t) o || l != (size_t) l)
+      return false;
+    *offset = (size_t) o;
+    *length = (size_t) l;
+    return true;
+  }
+
+  // TimeSignature.decodeAll(data, [offset, length]) -> Array of TimeSignatures
+  // decodes back-to-back concatenated DER tokens
+  static NAN_METHOD(DecodeAll)
+  {
+    NanScope();
+
+    if (args.Length() != 1 && args.Length() != 3) {
+      return NanThrowTypeError("Wrong number of arguments");
+    }
+    ASSERT_IS_STRING_OR_BUFFER(args[0]);
+    DECODE_BINARY(input, args[0]);
+
+    size_t offset = 0, length = input.length;
+    if (args.Length() == 3 && !get_range(args[1], args[2], input.length, &offset, &length)) {
+      return NanThrowTypeError("Bad offset or length");
+    }
+
+    Local<Array> result = NanNew<Array>();
+    const unsigned char *data = (const unsigned char *) input.data + offset;
+    uint32_t i = 0;
+    while (length > 0) {
+      size_t n = der_object_length(data, length);
+      if (n == 0)
+        return NanThrowError("Invalid format of concatenated tokens");
+      GTTimestamp *timestamp;
+      int res = GTTimestamp_DERDecode(data, n, &timestamp);
+      ASSERT_GT_ERROR(res);
+      result->Set(i++, NewInstance(timestamp, n));
+      data += n;
+      length -= n;
+    }
+    NanReturnValue(result);
+  }
+
   static Local<String> format_location_id(GT_UInt64 l)
   {
     char buf[32];
@@ -205,54 +710,64 @@ public:
     }    
   }
 
+  // builds the properties object returned by verify(), see VerificationResult
+  static Local<Object> verification_info_as_Object(SharedVerificationInfo *verification_info);
+
+  // GTTimestamp_verify() with verification errors folded into the status code;
+  // safe to call off the main thread.
+  static int verify_timestamp(const GTTimestamp *timestamp, int parse_data,
+        GTVerificationInfo **verification_info)
+  {
+    GTVerificationInfo *vi = NULL;
+    int res = GTTimestamp_verify(timestamp, parse_data, &vi);
+    if (res != GT_OK)
+      return res;
+    if (vi->verification_errors != GT_NO_FAILURES) {
+      GTVerificationInfo_free(vi);
+      return TS_VERIFICATION_FAILURE;
+    }
+    *verification_info = vi;
+    return GT_OK;
+  }
+
+  // publication check against decoded publications file, see CheckPublication();
+  // safe to call off the main thread. verification_info of an earlier
+  // verify_timestamp() call saves verifying non-extended timestamps again.
+  static int check_publication(const GTTimestamp *timestamp, const GTPublicationsFile *pub,
+        const GTVerificationInfo *verification_info = NULL)
+  {
+    int res;
+    int ext = GTTimestamp_isExtended(timestamp);
+    if (ext == GT_EXTENDED)
+      return GTTimestamp_checkPublication(timestamp, pub);
+    if (ext != GT_NOT_EXTENDED)
+      return ext;
+
+    if (verification_info != NULL)
+      return GTTimestamp_checkPublicKey(timestamp,
+          verification_info->implicit_data->registered_time, pub);
+
+    GTVerificationInfo *vi = NULL;
+    res = verify_timestamp(timestamp, 0, &vi);
+    if (res != GT_OK)
+      return res;
+    GT_Time_t64 history_id = vi->implicit_data->registered_time;
+    GTVerificationInfo_free(vi);
+    return GTTimestamp_checkPublicKey(timestamp, history_id, pub);
+  }
+
   // no arguments, just syntax check
   static NAN_METHOD(Verify)
   {
     NanScope();
     UNWRAP_ts();
 
-    GTVerificationInfo *verification_info = NULL;
-    int res = GTTimestamp_verify(ts->timestamp, 1, &verification_info);
-    ASSERT_GT_ERROR(res);
-
-    if (verification_info->verification_errors != GT_NO_FAILURES) {
-        GTVerificationInfo_free(verification_info);
-        return NanThrowError("TimeSignature verification error");
-    }
-
-    Local<Object> result = NanNew<Object>();
-    result->Set(NanNew<String>("verification_status"), NanNew<Integer>(verification_info->verification_status));
-    result->Set(NanNew<String>("location_id"), format_location_id(verification_info->implicit_data->location_id));
-    if (verification_info->implicit_data->location_name != NULL)
-      result->Set(NanNew<String>("location_name"), NanNew<String>(verification_info->implicit_data->location_name));
-    result->Set(NanNew<String>("registered_time"), NODE_UNIXTIME_V8(verification_info->implicit_data->registered_time));
-
-    if (verification_info->explicit_data->policy != NULL)
-      result->Set(NanNew<String>("policy"), NanNew<String>(verification_info->explicit_data->policy));
-    result->Set(NanNew<String>("hash_algorithm"), hash_algorithm_name_as_String(verification_info->explicit_data->hash_algorithm));
-    if (verification_info->explicit_data->hash_value != NULL)
-      result->Set(NanNew<String>("hash_value"), NanNew<String>(verification_info->explicit_data->hash_value));
-    if (verification_info->explicit_data->issuer_name != NULL)
-      result->Set(NanNew<String>("issuer_name"), NanNew<String>(verification_info->explicit_data->issuer_name));
-
-    // not extended:
-    if (verification_info->implicit_data->public_key_fingerprint != NULL)
-      result->Set(NanNew<String>("public_key_fingerprint"), NanNew<String>(verification_info->implicit_data->public_key_fingerprint));
-
-    // extended:
-    if (verification_info->implicit_data->publication_string != NULL) {
-      result->Set(NanNew<String>("publication_string"), NanNew<String>(verification_info->implicit_data->publication_string));
-      result->Set(NanNew<String>("publication_identifier"), NanNew<Number>(verification_info->explicit_data->publication_identifier));
-      result->Set(NanNew<String>("publication_time"), NODE_UNIXTIME_V8(verification_info->explicit_data->publication_identifier));
-
-      Handle<Array> refarr = NanNew<Array>(verification_info->explicit_data->pub_reference_count);
-      for (int i = 0; i < verification_info->explicit_data->pub_reference_count; i++)
-        refarr->Set(i, NanNew<String>(verification_info->explicit_data->pub_reference_list[i]));
-      result->Set(NanNew<String>("pub_reference_list"), refarr);
-    }
+    const GTVerificationInfo *verification_info;
+    int res = ts->get_verification_info(&verification_info, 1);
+    if (res != GT_OK)
+      return NanThrowError(error_string(res));
 
-    GTVerificationInfo_free(verification_info);
-    NanReturnValue(result);
+    NanReturnValue(verification_info_as_Object(ts->verification_info));
   }
 
 
@@ -291,18 +806,12 @@ public:
     NanScope();
     UNWRAP_ts();
 
-    GTVerificationInfo *verification_info = NULL;
-    int res = GTTimestamp_verify(ts->timestamp, 0, &verification_info);
-    ASSERT_GT_ERROR(res);
-
-    if (verification_info->verification_errors != GT_NO_FAILURES) {
-      GTVerificationInfo_free(verification_info);
-      return NanThrowError("TimeSignature verification error");
-    }
+    const GTVerificationInfo *verification_info;
+    int res = ts->get_verification_info(&verification_info, 0);
+    if (res != GT_OK)
+      return NanThrowError(error_string(res));
 
-    double result = verification_info->implicit_data->registered_time;
-    GTVerificationInfo_free(verification_info);
-    NanReturnValue(NODE_UNIXTIME_V8(result));
+    NanReturnValue(NODE_UNIXTIME_V8(verification_info->implicit_data->registered_time));
   }
 
     // ts.compareHash(binary hash in Buffer, algo)  -> bit flag
@@ -319,8 +828,7 @@ public:
     if (args.Length() == 2 && !args[1]->IsString()) {
       return NanThrowTypeError("Optional 2nd argument must be hash type as string");
     }
-    ssize_t len = DecodeBytes(args[0], BINARY);
-    ASSERT_IS_POSITIVE(len);
+    DECODE_BINARY(hash, args[0]);
 
     int hashalg_gt_id = 1;
     if (args.Length() == 2)
@@ -332,21 +840,9 @@ public:
     GTDataHash dh;
     dh.context = NULL;
     dh.algorithm = hashalg_gt_id;
-    int res;
-    if (Buffer::HasInstance(args[0])) {
-      Local<Object> buffer_obj = args[0]->ToObject();
-      dh.digest = (unsigned char *) Buffer::Data(buffer_obj);
-      dh.digest_length = len;
-      res = GTTimestamp_checkDocumentHash(ts->timestamp, &dh);
-    } else {  // string
-      char* buf = new char[len];
-      ssize_t written = DecodeWrite(buf, len, args[0], BINARY);
-      assert(written == len);
-      dh.digest = (unsigned char*) buf;
-      dh.digest_length = len;
-      res = GTTimestamp_checkDocumentHash(ts->timestamp, &dh);
-      delete [] buf;
-    }
+    dh.digest = (unsigned char *) hash.data;
+    dh.digest_length = hash.length;
+    int res = GTTimestamp_checkDocumentHash(ts->timestamp, &dh);
 
     ASSERT_GT_ERROR(res);
     NanReturnValue(NanNew<Integer>(GT_DOCUMENT_HASH_CHECKED));
@@ -360,58 +856,27 @@ public:
     UNWRAP_ts();
 
     ASSERT_IS_N_ARGS(1);
-    ASSERT_IS_STRING_OR_BUFFER(args[0]);
-
-    ssize_t len = DecodeBytes(args[0], BINARY);
-    ASSERT_IS_POSITIVE(len);
 
     int res;
-    GTPublicationsFile *pub;
-    if (Buffer::HasInstance(args[0])) {
-      Local<Object> buffer_obj = args[0]->ToObject();
-      char *buffer_data = Buffer::Data(buffer_obj);
-      res = GTPublicationsFile_DERDecode(buffer_data, len, &pub);
-    } else {
-      char* buf = new char[len];
-      ssize_t written = DecodeWrite(buf, len, args[0], BINARY);
-      assert(written == len);
-      res = GTPublicationsFile_DERDecode(buf, len, &pub);
-      delete [] buf;
+    if (PublicationsFile::HasInstance(args[0])) {
+      PublicationsFile *pf = ObjectWrap::Unwrap<PublicationsFile>(args[0]->ToObject());
+      res = ts->check_publication(pf->publications);
+      if (res != GT_OK)
+        return NanThrowError(error_string(res));
+      NanReturnValue(NanNew<Integer>(GT_PUBLICATION_CHECKED));
     }
-    ASSERT_GT_ERROR(res);
 
-    int ext = GTTimestamp_isExtended(ts->timestamp);
-    if (ext == GT_EXTENDED)
-    {
-      res = GTTimestamp_checkPublication(ts->timestamp, pub);
-    }
-    else if (ext == GT_NOT_EXTENDED)
-    {
-      GTVerificationInfo *verification_info = NULL;
-      res = GTTimestamp_verify(ts->timestamp, 0, &verification_info);
-      if (res != GT_OK) {
-        GTPublicationsFile_free(pub);
-        ASSERT_GT_ERROR(res);
-      }
-
-      if (verification_info->verification_errors != GT_NO_FAILURES) {
-        GTVerificationInfo_free(verification_info);
-        GTPublicationsFile_free(pub);
-        return NanThrowError("TimeSignature verification error");
-      }
+    ASSERT_IS_STRING_OR_BUFFER(args[0]);
+    DECODE_BINARY(input, args[0]);
 
-      GT_Time_t64 history_id = verification_info->implicit_data->registered_time;
-      GTVerificationInfo_free(verification_info);
-      res = GTTimestamp_checkPublicKey(ts->timestamp, history_id, pub);
-    }
-    else
-    {
-      GTPublicationsFile_free(pub);
-      ASSERT_GT_ERROR(ext);
-    }
+    GTPublicationsFile *pub;
+    res = GTPublicationsFile_DERDecode(input.data, input.length, &pub);
+    ASSERT_GT_ERROR(res);
 
+    res = ts->check_publication(pub);
     GTPublicationsFile_free(pub);
-    ASSERT_GT_ERROR(res);
+    if (res != GT_OK)
+      return NanThrowError(error_string(res));
     NanReturnValue(NanNew<Integer>(GT_PUBLICATION_CHECKED));
   }
 
@@ -421,20 +886,15 @@ public:
     NanScope();
     UNWRAP_ts();
 
-    GTVerificationInfo *verification_info = NULL;
-    int res = GTTimestamp_verify(ts->timestamp, 0, &verification_info);
-    ASSERT_GT_ERROR(res);
+    const GTVerificationInfo *verification_info;
+    int res = ts->get_verification_info(&verification_info, 0);
+    if (res != GT_OK)
+      return NanThrowError(error_string(res));
 
-    if (verification_info->verification_errors != GT_NO_FAILURES) {
-      GTVerificationInfo_free(verification_info);
-      return NanThrowError("TimeSignature verification error");
-    }
-    Local<String> result = NanNew<String>(
+    NanReturnValue(NanNew<String>(
           (verification_info->implicit_data->location_name != NULL) ?
             verification_info->implicit_data->location_name :
-            "");
-    GTVerificationInfo_free(verification_info);
-    NanReturnValue(result);
+            ""));
   }
 
   // returns DER encoded ts token
@@ -448,9 +908,7 @@ public:
     int res = GTTimestamp_getDEREncoded(ts->timestamp, &data, &data_length);
     ASSERT_GT_ERROR(res);
 
-    Local<Object> result = NanNewBufferHandle((char *)data, data_length);
-    GT_free(data);
-    NanReturnValue(result);
+    NanReturnValue(gt_data_as_Buffer(data, data_length));
   }
 
   // Buffer = composeExtendingRequest()
@@ -465,9 +923,7 @@ public:
     int res = GTTimestamp_prepareExtensionRequest(ts->timestamp, &request, &request_length);
     ASSERT_GT_ERROR(res);
 
-    Local<Object> result = NanNewBufferHandle((char *)request, request_length);
-    GT_free(request);
-    NanReturnValue(result);
+    NanReturnValue(gt_data_as_Buffer(request, request_length));
   }
 
     // ts.extend(extending response)
@@ -476,39 +932,36 @@ public:
   {
     NanScope();
     UNWRAP_ts();
+    ASSERT_NOT_BUSY(ts);
 
     ASSERT_IS_N_ARGS(1);
     ASSERT_IS_STRING_OR_BUFFER(args[0]);
+    DECODE_BINARY(response, args[0]);
 
-    ssize_t len = DecodeBytes(args[0], BINARY);
-    ASSERT_IS_POSITIVE(len);
-
-    int res;
     GTTimestamp *new_ts;
-    if (Buffer::HasInstance(args[0])) {
-      Local<Object> buffer_obj = args[0]->ToObject();
-      char *buffer_data = Buffer::Data(buffer_obj);
-      size_t buffer_length = Buffer::Length(buffer_obj);
-      res = GTTimestamp_createExtendedTimestamp(ts->timestamp, buffer_data, buffer_length, &new_ts);
-    } else {
-      char* buf = new char[len];
-      ssize_t written = DecodeWrite(buf, len, args[0], BINARY);
-      assert(written == len);
-      res = GTTimestamp_createExtendedTimestamp(ts->timestamp, buf, len, &new_ts);
-      delete [] buf;
-    }
+    int res = GTTimestamp_createExtendedTimestamp(ts->timestamp, response.data, response.length, &new_ts);
     if (res == GT_ALREADY_EXTENDED || res == GT_NONSTD_EXTEND_LATER || res == GT_NONSTD_EXTENSION_OVERDUE)
       NanReturnValue(NanNew<Integer>(res));
 
     ASSERT_GT_ERROR(res);
 
-    GTTimestamp_free(ts->timestamp);
-    ts->timestamp = new_ts;
+    ts->replace_timestamp(new_ts, der_size(new_ts, response.length));
 
     NanReturnValue(NanTrue());
   }
 
 
+  // ts.dispose() releases the native timestamp without waiting for GC
+  static NAN_METHOD(Dispose)
+  {
+    NanScope();
+    TimeSignature* ts = ObjectWrap::Unwrap<TimeSignature>(args.This());
+    ASSERT_NOT_BUSY(ts);
+    ts->release();
+    NanReturnUndefined();
+  }
+
+
   static NAN_METHOD(IsEarlierThan)
   {
     NanScope();
@@ -548,8 +1001,7 @@ public:
     if (args.Length() == 2 && !args[1]->IsString()) {
       return NanThrowTypeError("Optional 2nd argument must be hash algorithm name as string");
     }
-    ssize_t len = DecodeBytes(args[0], BINARY);
-    ASSERT_IS_POSITIVE(len);
+    DECODE_BINARY(hash, args[0]);
 
     int hashalg_gt_id = 1;
     if (args.Length() == 2)
@@ -561,28 +1013,183 @@ public:
     GTDataHash dh;
     dh.context = NULL;
     dh.algorithm = hashalg_gt_id;
+    dh.digest = (unsigned char *) hash.data;
+    dh.digest_length = hash.length;
     unsigned char *request = NULL;
     size_t request_length;
-    int res;
-    if (Buffer::HasInstance(args[0])) {
-      Local<Object> buffer_obj = args[0]->ToObject();
-      dh.digest = (unsigned char *) Buffer::Data(buffer_obj);
-      dh.digest_length = Buffer::Length(buffer_obj);
-      res = GTTimestamp_prepareTimestampRequest(&dh, &request, &request_length);
-    } else {  // string
-      char* buf = new char[len];
-      ssize_t written = DecodeWrite(buf, len, args[0], BINARY);
-      assert(written == len);
-      dh.digest = (unsigned char*) buf;
-      dh.digest_length = len;
-      res = GTTimestamp_prepareTimestampRequest(&dh, &request, &request_length);
-      delete [] buf;
+    int res = GTTimestamp_prepareTimestampRequest(&dh, &request, &request_length);
+    ASSERT_GT_ERROR(res);
+
+    NanReturnValue(gt_data_as_Buffer(request, request_length));
+  }
+
+  // TimeSignature.composeRequests(digests, [algo]) -> {data: Buffer, offsets: Array}
+  // digests are packed back to back into one Buffer; the requests are
+  // concatenated likewise, request i being data[offsets[i] .. offsets[i + 1]).
+  static NAN_METHOD(ComposeRequests)
+  {
+    NanScope();
+
+    if (args.Length() < 1 || args.Length() > 2) {
+      return NanThrowTypeError("Wrong number of arguments");
+    }
+    ASSERT_IS_STRING_OR_BUFFER(args[0]);
+
+    if (args.Length() == 2 && !args[1]->IsString()) {
+      return NanThrowTypeError("Optional 2nd argument must be hash algorithm name as string");
+    }
+    DECODE_BINARY(digests, args[0]);
+
+    int hashalg_gt_id = 1;
+    if (args.Length() == 2)
+      hashalg_gt_id = getAlgoID(*String::Utf8Value(args[1]->ToString()));
+    if (hashalg_gt_id < 0) {
+      return NanThrowTypeError("Unsupported hash algorithm");
+    }
+#ifndef PREINSTALLED_LIBGT
+    size_t digest_length = GT_getHashSize(hashalg_gt_id);
+#else
+    // digest sizes are internal to libgt, OpenSSL knows them by name
+    const EVP_MD *md = EVP_get_digestbyname(
+        *String::Utf8Value(hash_algorithm_name_as_String(hashalg_gt_id)));
+    if (md == NULL) {
+      return NanThrowTypeError("Unsupported hash algorithm");
+    }
+    size_t digest_length = EVP_MD_size(md);
+#endif
+    if (digests.length == 0 || digests.length % digest_length != 0) {
+      return NanThrowTypeError("Digests length must be a multiple of the hash size");
+    }
+    size_t count = digests.length / digest_length;
+
+    unsigned char **requests = new unsigned char*[count]();
+    size_t *lengths = new size_t[count]();
+    size_t total = 0;
+    int res = GT_OK;
+    GTDataHash dh;
+    dh.context = NULL;
+    dh.algorithm = hashalg_gt_id;
+    dh.digest_length = digest_length;
+    for (size_t i = 0; i < count && res == GT_OK; i++) {
+      dh.digest = (unsigned char *) digests.data + i * digest_length;
+      res = GTTimestamp_prepareTimestampRequest(&dh, &requests[i], &lengths[i]);
+      if (res == GT_OK)
+        total += lengths[i];
+    }
+
+    unsigned char *data = NULL;
+    if (res == GT_OK) {
+      data = (unsigned char *) GT_malloc(total);
+      if (data == NULL)
+        res = GT_OUT_OF_MEMORY;
+    }
+    Local<Array> offsets = NanNew<Array>(count + 1);
+    size_t pos = 0;
+    for (size_t i = 0; i < count; i++) {
+      if (res == GT_OK) {
+        offsets->Set(i, NanNew<Number>(pos));
+        memcpy(data + pos, requests[i], lengths[i]);
+        pos += lengths[i];
+      }
+      GT_free(requests[i]);
+    }
+    delete [] requests;
+    delete [] lengths;
+    ASSERT_GT_ERROR(res);
+    offsets->Set(count, NanNew<Number>(pos));
+
+    Local<Object> result = NanNew<Object>();
+    result->Set(NanNew<String>("data"), gt_data_as_Buffer(data, total));
+    result->Set(NanNew<String>("offsets"), offsets);
+    NanReturnValue(result);
+  }
+
+  // TimeSignature.aggregate(digests, [algo]) -> {root: Buffer, chains: Array}
+  // digests are packed back to back like for composeRequests(); only the
+  // root needs to be signed, chains[i] links digest i to it and is checked
+  // with verifyAggregated().
+  static NAN_METHOD(Aggregate)
+  {
+    NanScope();
+
+    if (args.Length() < 1 || args.Length() > 2) {
+      return NanThrowTypeError("Wrong number of arguments");
+    }
+    ASSERT_IS_STRING_OR_BUFFER(args[0]);
+
+    if (args.Length() == 2 && !args[1]->IsString()) {
+      return NanThrowTypeError("Optional 2nd argument must be hash algorithm name as string");
+    }
+#ifdef PREINSTALLED_LIBGT
+    return NanThrowError("Aggregation is not supported with preinstalled libgt");
+#else
+    DECODE_BINARY(digests, args[0]);
+
+    int hashalg_gt_id = 1;
+    if (args.Length() == 2)
+      hashalg_gt_id = getAlgoID(*String::Utf8Value(args[1]->ToString()));
+    if (hashalg_gt_id < 0) {
+      return NanThrowTypeError("Unsupported hash algorithm");
+    }
+    size_t size = GT_getHashSize(hashalg_gt_id);
+    if (digests.length == 0 || digests.length % size != 0) {
+      return NanThrowTypeError("Digests length must be a multiple of the hash size");
+    }
+    size_t count = digests.length / size;
+    const unsigned char *leaves = (const unsigned char *) digests.data;
+
+    // levels of the tree from the leaves up; a node without a sibling
+    // moves up unchanged and its chain gets no step for that level
+    std::vector<std::vector<unsigned char> > levels(1,
+        std::vector<unsigned char>(count * size));
+    for (size_t i = 0; i < count; i++)
+      GT_calculateDigest(leaves + i * size, size, &levels[0][i * size], hashalg_gt_id);
+    while (levels.back().size() > size) {
+      const std::vector<unsigned char> &below = levels.back();
+      size_t n = below.size() / size;
+      std::vector<unsigned char> above((n + 1) / 2 * size);
+      for (size_t j = 0; j < n / 2; j++)
+        aggregate_node(hashalg_gt_id, &below[2 * j * size], &below[(2 * j + 1) * size],
+            levels.size(), &above[j * size]);
+      if (n % 2)
+        memcpy(&above[n / 2 * size], &below[(n - 1) * size], size);
+      levels.push_back(above);
+    }
+
+    Local<Array> chains = NanNew<Array>(count);
+    int res = GT_OK;
+    for (size_t i = 0; i < count && res == GT_OK; i++) {
+      if (count == 1) {
+        chains->Set(i, NanNewBufferHandle(0));
+        break;
+      }
+      GTHCConstructor *hc;
+      res = GTHCConstructor_new(hashalg_gt_id, levels.size() - 1, &hc);
+      if (res != GT_OK)
+        break;
+      size_t index = i;
+      for (size_t l = 0; l + 1 < levels.size() && res == GT_OK; l++, index /= 2) {
+        size_t sibling = index ^ 1;
+        if (sibling * size < levels[l].size())
+          res = GTHCConstructor_addStep(hc, hashalg_gt_id, &levels[l][sibling * size],
+              index % 2 == 0, l + 1);
+      }
+      if (res == GT_OK) {
+        size_t chain_length;
+        unsigned char *chain = GTHCConstructor_getHashChain(hc, &chain_length);
+        chains->Set(i, NanNewBufferHandle((char *) chain, chain_length));
+        OPENSSL_free(chain);
+      }
+      GTHCConstructor_free(hc);
     }
     ASSERT_GT_ERROR(res);
 
-    Local<Object> result = NanNewBufferHandle((char *)request, request_length);
-    GT_free(request);
+    Local<Object> result = NanNew<Object>();
+    result->Set(NanNew<String>("root"), NanNewBufferHandle(count == 1 ?
+        (char *) leaves : (char *) &levels.back()[0], size));
+    result->Set(NanNew<String>("chains"), chains);
     NanReturnValue(result);
+#endif
   }
 
 
@@ -593,23 +1200,10 @@ public:
 
     ASSERT_IS_N_ARGS(1);
     ASSERT_IS_STRING_OR_BUFFER(args[0]);
+    DECODE_BINARY(response, args[0]);
 
-    ssize_t len = DecodeBytes(args[0], BINARY);
-    ASSERT_IS_POSITIVE(len);
-
-    int res;
     GTTimestamp *timestamp;
-    if (Buffer::HasInstance(args[0])) {
-      Local<Object> buffer_obj = args[0]->ToObject();
-      char *buffer_data = Buffer::Data(buffer_obj);
-      res = GTTimestamp_createTimestamp(buffer_data, len, &timestamp);
-    } else {
-      char* buf = new char[len];
-      ssize_t written = DecodeWrite(buf, len, args[0], BINARY);
-      assert(written == len);
-      res = GTTimestamp_createTimestamp(buf, len, &timestamp);
-      delete [] buf;
-    }
+    int res = GTTimestamp_createTimestamp(response.data, response.length, &timestamp);
     ASSERT_GT_ERROR(res);
 
     unsigned char *data;
@@ -618,9 +1212,26 @@ public:
     GTTimestamp_free(timestamp);
     ASSERT_GT_ERROR(res);
 
-    Local<Object> result = NanNewBufferHandle((char *)data, data_length);
-    GT_free(data);
-    NanReturnValue(result);
+    NanReturnValue(gt_data_as_Buffer(data, data_length));
+  }
+
+
+  // TimeSignature.fromResponse(response) -> TimeSignature
+  // same as new TimeSignature(processResponse(response)) but the parsed
+  // timestamp is kept instead of being encoded and decoded again
+  static NAN_METHOD(FromResponse)
+  {
+    NanScope();
+
+    ASSERT_IS_N_ARGS(1);
+    ASSERT_IS_STRING_OR_BUFFER(args[0]);
+    DECODE_BINARY(response, args[0]);
+
+    GTTimestamp *timestamp;
+    int res = GTTimestamp_createTimestamp(response.data, response.length, &timestamp);
+    ASSERT_GT_ERROR(res);
+
+    NanReturnValue(NewInstance(timestamp, response.length));
   }
 
 
@@ -631,25 +1242,10 @@ public:
 
     ASSERT_IS_N_ARGS(1);
     ASSERT_IS_STRING_OR_BUFFER(args[0]);
-    ssize_t len = DecodeBytes(args[0], BINARY);
-    ASSERT_IS_POSITIVE(len);
-
-    bool bufferAllocated = false;
-    char *buf;
-    if (Buffer::HasInstance(args[0])) {
-      Local<Object> buffer_obj = args[0]->ToObject();
-      buf = Buffer::Data(buffer_obj);
-    } else {
-      buf = new char[len];
-      bufferAllocated = true;
-      ssize_t written = DecodeWrite(buf, len, args[0], BINARY);
-      assert(written == len);
-    }
+    DECODE_BINARY(input, args[0]);
 
     GTPublicationsFile *pub;
-    int res = GTPublicationsFile_DERDecode(buf, len, &pub);
-    if (bufferAllocated)
-      delete [] buf;
+    int res = GTPublicationsFile_DERDecode(input.data, input.length, &pub);
     ASSERT_GT_ERROR(res);
 
     GTPubFileVerificationInfo *vi;
@@ -667,6 +1263,19 @@ public:
 
   }
 
+  // asynchronous variants, executed on the libuv thread pool
+  static NAN_METHOD(VerifyAsync);
+  static NAN_METHOD(CompareHashAsync);
+  static NAN_METHOD(CheckPublicationAsync);
+  static NAN_METHOD(ExtendAsync);
+  static NAN_METHOD(VerifyDocument);
+  static NAN_METHOD(VerifyAggregated);
+  static NAN_METHOD(ProcessResponseAsync);
+  static NAN_METHOD(FromResponseAsync);
+  static NAN_METHOD(VerifyPublicationsAsync);
+  static NAN_METHOD(VerifyBatch);
+  static NAN_METHOD(HashFile);
+
 private:
   static int getAlgoID(const char *algoName) {
       return (
@@ -689,6 +1298,1226 @@ private:
 
 Persistent<FunctionTemplate> TimeSignature::constructor_template;
 
+
+// Properties object returned by verify(): a plain object with the fields
+// that apply, set with internalized keys created once at load time.
+class VerificationResult
+{
+public:
+  static void Init()
+  {
+    NanScope();
+
+    for (int i = 0; i < KEY_COUNT; i++)
+      NanAssignPersistent(keys[i], internalized(key_names[i]));
+  }
+
+  // status_flags: checks done in addition to the verification
+  static Local<Object> New(const GTVerificationInfo *vi, int status_flags = 0)
+  {
+    Local<Object> result = NanNew<Object>();
+    result->Set(key(KEY_VERIFICATION_STATUS), NanNew<Integer>(vi->verification_status | status_flags));
+    result->Set(key(KEY_LOCATION_ID), TimeSignature::format_location_id(vi->implicit_data->location_id));
+    if (vi->implicit_data->location_name != NULL)
+      result->Set(key(KEY_LOCATION_NAME), NanNew<String>(vi->implicit_data->location_name));
+    result->Set(key(KEY_REGISTERED_TIME), NODE_UNIXTIME_V8(vi->implicit_data->registered_time));
+
+    if (vi->explicit_data->policy != NULL)
+      result->Set(key(KEY_POLICY), NanNew<String>(vi->explicit_data->policy));
+    result->Set(key(KEY_HASH_ALGORITHM), TimeSignature::hash_algorithm_name_as_String(vi->explicit_data->hash_algorithm));
+    if (vi->explicit_data->hash_value != NULL)
+      result->Set(key(KEY_HASH_VALUE), NanNew<String>(vi->explicit_data->hash_value));
+    if (vi->explicit_data->issuer_name != NULL)
+      result->Set(key(KEY_ISSUER_NAME), NanNew<String>(vi->explicit_data->issuer_name));
+
+    // not extended:
+    if (vi->implicit_data->public_key_fingerprint != NULL)
+      result->Set(key(KEY_PUBLIC_KEY_FINGERPRINT), NanNew<String>(vi->implicit_data->public_key_fingerprint));
+
+    // extended:
+    if (vi->implicit_data->publication_string != NULL) {
+      result->Set(key(KEY_PUBLICATION_STRING), NanNew<String>(vi->implicit_data->publication_string));
+      result->Set(key(KEY_PUBLICATION_IDENTIFIER), NanNew<Number>(vi->explicit_data->publication_identifier));
+      result->Set(key(KEY_PUBLICATION_TIME), NODE_UNIXTIME_V8(vi->explicit_data->publication_identifier));
+
+      Local<Array> refarr = NanNew<Array>(vi->explicit_data->pub_reference_count);
+      for (int i = 0; i < vi->explicit_data->pub_reference_count; i++)
+        refarr->Set(i, NanNew<String>(vi->explicit_data->pub_reference_list[i]));
+      result->Set(key(KEY_PUB_REFERENCE_LIST), refarr);
+    }
+    return result;
+  }
+
+private:
+  enum {
+    KEY_VERIFICATION_STATUS,
+    KEY_LOCATION_ID,
+    KEY_LOCATION_NAME,
+    KEY_REGISTERED_TIME,
+    KEY_POLICY,
+    KEY_HASH_ALGORITHM,
+    KEY_HASH_VALUE,
+    KEY_ISSUER_NAME,
+    KEY_PUBLIC_KEY_FINGERPRINT,
+    KEY_PUBLICATION_STRING,
+    KEY_PUBLICATION_IDENTIFIER,
+    KEY_PUBLICATION_TIME,
+    KEY_PUB_REFERENCE_LIST,
+    KEY_COUNT
+  };
+  static const char *key_names[KEY_COUNT];
+  static Persistent<String> keys[KEY_COUNT];
+
+  static Local<String> internalized(const char *name)
+  {
+#if NODE_MODULE_VERSION > 0x000B
+    return String::NewFromUtf8(Isolate::GetCurrent(), name, String::kInternalizedString);
+#else
+    return String::NewSymbol(name);
+#endif
+  }
+
+  static Local<String> key(int k)
+  {
+    return NanNew(keys[k]);
+  }
+};
+
+const char *VerificationResult::key_names[KEY_COUNT] = {
+  "verification_status",
+  "location_id",
+  "location_name",
+  "registered_time",
+  "policy",
+  "hash_algorithm",
+  "hash_value",
+  "issuer_name",
+  "public_key_fingerprint",
+  "publication_string",
+  "publication_identifier",
+  "publication_time",
+  "pub_reference_list"
+};
+Persistent<String> VerificationResult::keys[KEY_COUNT];
+
+Local<Object> TimeSignature::verification_info_as_Object(SharedVerificationInfo *verification_info)
+{
+  return VerificationResult::New(verification_info->info);
+}
+
+
+// Base for the asynchronous workers: holds the binary input and the libgt
+// status code of the work done in Execute().
+class GTWorker : public NanAsyncWorker
+{
+public:
+  GTWorker(NanCallback *callback) : NanAsyncWorker(callback), res(GT_OK) {}
+
+  bool SetInput(Handle<Value> val)
+  {
+    if (val->IsObject())
+      SaveToPersistent("input", val->ToObject());
+    return input.Set(val);
+  }
+
+protected:
+  BinaryInput input;
+  int res;
+
+  void SetStatus(int status)
+  {
+    res = status;
+    if (res != GT_OK)
+      SetErrorMessage(error_string(res));
+  }
+};
+
+
+// Worker reading the timestamp of a TimeSignature. The wrapping object is
+// kept alive and Extend() is refused until the callback has been made, or
+// until the worker is deleted without having been queued.
+class TimeSignatureWorker : public GTWorker
+{
+public:
+  TimeSignatureWorker(NanCallback *callback, Local<Object> handle, TimeSignature *ts)
+      : GTWorker(callback), ts(ts), timestamp(ts->timestamp), released(false)
+  {
+    SaveToPersistent("timesignature", handle);
+    ts->pending++;
+  }
+
+  ~TimeSignatureWorker()
+  {
+    Release();
+  }
+
+  virtual void WorkComplete()
+  {
+    Release();
+    GTWorker::WorkComplete();
+  }
+
+protected:
+  TimeSignature *ts;
+  const GTTimestamp *timestamp;
+
+private:
+  bool released;
+
+  void Release()
+  {
+    if (released)
+      return;
+    released = true;
+    if (--ts->pending == 0 && ts->retired_timestamp != NULL) {
+      GTTimestamp_free(ts->retired_timestamp);
+      ts->retired_timestamp = NULL;
+    }
+  }
+};
+
+
+class VerifyWorker : public TimeSignatureWorker
+{
+public:
+  // with a memoized verification result the properties are ready at once
+  // and Execute() has nothing to do
+  VerifyWorker(NanCallback *callback, Local<Object> handle, TimeSignature *ts)
+      : TimeSignatureWorker(callback, handle, ts), verification_info(NULL),
+        memoized(ts->verification_info != NULL && ts->verification_parsed)
+  {
+    if (memoized)
+      SaveToPersistent("properties",
+          TimeSignature::verification_info_as_Object(ts->verification_info));
+  }
+
+  ~VerifyWorker()
+  {
+    GTVerificationInfo_free(verification_info);
+  }
+
+  void Execute()
+  {
+    if (!memoized)
+      SetStatus(TimeSignature::verify_timestamp(timestamp, 1, &verification_info));
+  }
+
+  void HandleOKCallback()
+  {
+    NanScope();
+    Local<Value> properties;
+    if (memoized) {
+      properties = GetFromPersistent("properties");
+    } else {
+      SharedVerificationInfo *shared = new SharedVerificationInfo(verification_info);
+      verification_info = NULL;
+      properties = TimeSignature::verification_info_as_Object(shared);
+      // memoize unless the timestamp was extended meanwhile
+      if (ts->timestamp == timestamp && !ts->verification_parsed) {
+        if (ts->verification_info != NULL)
+          ts->verification_info->Unref();
+        ts->verification_info = shared;
+        ts->verification_parsed = true;
+      } else {
+        shared->Unref();
+      }
+    }
+    Local<Value> argv[] = { NanNull(), properties };
+    callback->Call(2, argv);
+  }
+
+private:
+  GTVerificationInfo *verification_info;
+  bool memoized;
+};
+
+
+// Complete verification of a document hash: verify(), compareHash() and
+// checkPublication() in one pass. Publication check is skipped if the
+// timestamp should be extended first, which is left for the caller.
+class DocumentWorker : public TimeSignatureWorker
+{
+public:
+  DocumentWorker(NanCallback *callback, Local<Object> handle, TimeSignature *ts,
+        int algorithm, Local<Object> pf_handle, bool no_extend)
+      : TimeSignatureWorker(callback, handle, ts), algorithm(algorithm), no_extend(no_extend),
+        shared(ts->verification_parsed ? ts->verification_info : NULL),
+        verification_info(NULL), status_flags(0),
+        needs_extension(false)
+  {
+    // memoized result stays valid even if the timestamp is extended meanwhile
+    if (shared != NULL)
+      shared->Ref();
+    SaveToPersistent("publications", pf_handle);
+    PublicationsFile *pf = ObjectWrap::Unwrap<PublicationsFile>(pf_handle);
+    publications = pf->publications;
+    last_publication_time = pf->last_publication_time;
+  }
+
+  // the document hash is a leaf of an aggregation tree, linked by the
+  // chain to the root hash in the timestamp
+  bool SetChain(Handle<Value> val)
+  {
+    if (val->IsObject())
+      SaveToPersistent("chain", val->ToObject());
+    return chain.Set(val);
+  }
+
+  ~DocumentWorker()
+  {
+    if (shared != NULL)
+      shared->Unref();
+    GTVerificationInfo_free(verification_info);
+  }
+
+  void Execute()
+  {
+    const GTVerificationInfo *vi;
+    if (shared != NULL) {
+      vi = shared->info;
+    } else {
+      int status = TimeSignature::verify_timestamp(timestamp, 1, &verification_info);
+      if (status != GT_OK)
+        return SetStatus(status);
+      vi = verification_info;
+    }
+
+    GTDataHash dh;
+    dh.context = NULL;
+    dh.algorithm = algorithm;
+    dh.digest = (unsigned char *) input.data;
+    dh.digest_length = input.length;
+    int status;
+#ifndef PREINSTALLED_LIBGT
+    unsigned char root[EVP_MAX_MD_SIZE];
+    if (chain.data != NULL) {
+      status = chain_root((const unsigned char *) chain.data, chain.length,
+          dh.digest, dh.digest_length, &dh.algorithm, root, &dh.digest_length);
+      if (status != GT_OK)
+        return SetStatus(status);
+      dh.digest = root;
+    }
+#endif
+    status = GTTimestamp_checkDocumentHash(timestamp, &dh);
+    if (status != GT_OK)
+      return SetStatus(status);
+    status_flags |= GT_DOCUMENT_HASH_CHECKED;
+
+    int ext = GTTimestamp_isExtended(timestamp);
+    if (ext == GT_NOT_EXTENDED && !no_extend &&
+        vi->implicit_data->registered_time <= last_publication_time) {
+      // a publication exists, extending gives the stronger proof
+      needs_extension = true;
+      return;
+    }
+    status = TimeSignature::check_publication(timestamp, publications,
+          ext == GT_NOT_EXTENDED ? vi : NULL);
+    if (status != GT_OK)
+      return SetStatus(status);
+    status_flags |= GT_PUBLICATION_CHECKED;
+  }
+
+  void HandleOKCallback()
+  {
+    NanScope();
+    if (shared == NULL) {
+      shared = new SharedVerificationInfo(verification_info);
+      verification_info = NULL;
+      if (ts->timestamp == timestamp && !ts->verification_parsed) {
+        if (ts->verification_info != NULL)
+          ts->verification_info->Unref();
+        ts->verification_info = shared;
+        ts->verification_parsed = true;
+        shared->Ref();
+      }
+    }
+    Local<Value> argv[] = {
+      NanNull(),
+      VerificationResult::New(shared->info, status_flags),
+      NanNew<Boolean>(needs_extension)
+    };
+    callback->Call(3, argv);
+  }
+
+private:
+  BinaryInput chain;
+  int algorithm;
+  bool no_extend;
+  SharedVerificationInfo *shared;
+  GTVerificationInfo *verification_info;
+  const GTPublicationsFile *publications;
+  double last_publication_time;
+  int status_flags;
+  bool needs_extension;
+};
+
+
+class CompareHashWorker : public TimeSignatureWorker
+{
+public:
+  CompareHashWorker(NanCallback *callback, Local<Object> handle, TimeSignature *ts, int algorithm)
+      : TimeSignatureWorker(callback, handle, ts), algorithm(algorithm) {}
+
+  void Execute()
+  {
+    GTDataHash dh;
+    dh.context = NULL;
+    dh.algorithm = algorithm;
+    dh.digest = (unsigned char *) input.data;
+    dh.digest_length = input.length;
+    SetStatus(GTTimestamp_checkDocumentHash(timestamp, &dh));
+  }
+
+  void HandleOKCallback()
+  {
+    NanScope();
+    Local<Value> argv[] = { NanNull(), NanNew<Integer>(GT_DOCUMENT_HASH_CHECKED) };
+    callback->Call(2, argv);
+  }
+
+private:
+  int algorithm;
+};
+
+
+class CheckPublicationWorker : public TimeSignatureWorker
+{
+public:
+  CheckPublicationWorker(NanCallback *callback, Local<Object> handle, TimeSignature *ts)
+      : TimeSignatureWorker(callback, handle, ts), publications(NULL) {}
+
+  // already decoded publications file, kept alive until the callback
+  void SetPublications(Local<Object> pf_handle)
+  {
+    SaveToPersistent("publications", pf_handle);
+    publications = ObjectWrap::Unwrap<PublicationsFile>(pf_handle)->publications;
+  }
+
+  void Execute()
+  {
+    if (publications != NULL) {
+      SetStatus(TimeSignature::check_publication(timestamp, publications));
+      return;
+    }
+    GTPublicationsFile *pub;
+    int status = GTPublicationsFile_DERDecode(input.data, input.length, &pub);
+    if (status == GT_OK) {
+      status = TimeSignature::check_publication(timestamp, pub);
+      GTPublicationsFile_free(pub);
+    }
+    SetStatus(status);
+  }
+
+  void HandleOKCallback()
+  {
+    NanScope();
+    Local<Value> argv[] = { NanNull(), NanNew<Integer>(GT_PUBLICATION_CHECKED) };
+    callback->Call(2, argv);
+  }
+
+private:
+  const GTPublicationsFile *publications;
+};
+
+
+class ExtendWorker : public TimeSignatureWorker
+{
+public:
+  ExtendWorker(NanCallback *callback, Local<Object> handle, TimeSignature *ts)
+      : TimeSignatureWorker(callback, handle, ts), extended(NULL), extended_length(0),
+        extend_result(GT_OK) {}
+
+  ~ExtendWorker()
+  {
+    if (extended != NULL)
+      GTTimestamp_free(extended);
+  }
+
+  void Execute()
+  {
+    int status = GTTimestamp_createExtendedTimestamp(timestamp, input.data, input.length, &extended);
+    if (status == GT_ALREADY_EXTENDED || status == GT_NONSTD_EXTEND_LATER || status == GT_NONSTD_EXTENSION_OVERDUE)
+      extend_result = status;
+    else
+      SetStatus(status);
+    if (extended != NULL)
+      extended_length = TimeSignature::der_size(extended, input.length);
+  }
+
+  // same results as the synchronous extend(): true, or one of the
+  // non-fatal status codes
+  void HandleOKCallback()
+  {
+    NanScope();
+    Local<Value> result;
+    if (extended != NULL) {
+      ts->replace_timestamp(extended, extended_length);
+      extended = NULL;
+      result = NanTrue();
+    } else {
+      result = NanNew<Integer>(extend_result);
+    }
+    Local<Value> argv[] = { NanNull(), result };
+    callback->Call(2, argv);
+  }
+
+private:
+  GTTimestamp *extended;
+  size_t extended_length;
+  int extend_result;
+};
+
+
+class ProcessResponseWorker : public GTWorker
+{
+public:
+  ProcessResponseWorker(NanCallback *callback)
+      : GTWorker(callback), data(NULL), data_length(0) {}
+
+  ~ProcessResponseWorker()
+  {
+    GT_free(data);
+  }
+
+  void Execute()
+  {
+    GTTimestamp *timestamp;
+    int status = GTTimestamp_createTimestamp(input.data, input.length, &timestamp);
+    if (status == GT_OK) {
+      status = GTTimestamp_getDEREncoded(timestamp, &data, &data_length);
+      GTTimestamp_free(timestamp);
+    }
+    SetStatus(status);
+  }
+
+  void HandleOKCallback()
+  {
+    NanScope();
+    Local<Value> argv[] = { NanNull(), gt_data_as_Buffer(data, data_length) };
+    data = NULL;
+    callback->Call(2, argv);
+  }
+
+private:
+  unsigned char *data;
+  size_t data_length;
+};
+
+
+class HashFileWorker : public GTWorker
+{
+public:
+  HashFileWorker(NanCallback *callback, const char *path, int algorithm)
+      : GTWorker(callback), path(path), algorithm(algorithm), data_hash(NULL),
+        sys_errno(0) {}
+
+  ~HashFileWorker()
+  {
+    GTDataHash_free(data_hash);
+  }
+
+  void Execute()
+  {
+    SetStatus(GT_hashFile(path.c_str(), algorithm, &data_hash));
+    if (res == GT_IO_ERROR)
+      sys_errno = errno;
+  }
+
+  // I/O errors as from fs, with code, errno and path
+  void HandleErrorCallback()
+  {
+    if (sys_errno == 0)
+      return GTWorker::HandleErrorCallback();
+    NanScope();
+    Local<Value> argv[] = { node::ErrnoException(sys_errno, NULL, "", path.c_str()) };
+    callback->Call(1, argv);
+  }
+
+  void HandleOKCallback()
+  {
+    NanScope();
+    Local<Value> argv[] = {
+      NanNull(),
+      NanNewBufferHandle((char *) data_hash->digest, data_hash->digest_length)
+    };
+    callback->Call(2, argv);
+  }
+
+private:
+  std::string path;
+  int algorithm;
+  GTDataHash *data_hash;
+  int sys_errno;
+};
+
+
+class FromResponseWorker : public GTWorker
+{
+public:
+  FromResponseWorker(NanCallback *callback)
+      : GTWorker(callback), timestamp(NULL) {}
+
+  ~FromResponseWorker()
+  {
+    if (timestamp != NULL)
+      GTTimestamp_free(timestamp);
+  }
+
+  void Execute()
+  {
+    SetStatus(GTTimestamp_createTimestamp(input.data, input.length, &timestamp));
+  }
+
+  void HandleOKCallback()
+  {
+    NanScope();
+    Local<Value> argv[] = { NanNull(), TimeSignature::NewInstance(timestamp, input.length) };
+    timestamp = NULL;
+    callback->Call(2, argv);
+  }
+
+private:
+  GTTimestamp *timestamp;
+};
+
+
+class VerifyPublicationsWorker : public GTWorker
+{
+public:
+  VerifyPublicationsWorker(NanCallback *callback)
+      : GTWorker(callback), publications(NULL), last_publication_time(0) {}
+
+  ~VerifyPublicationsWorker()
+  {
+    GTPublicationsFile_free(publications);
+  }
+
+  void Execute()
+  {
+    SetStatus(PublicationsFile::load(input.data, input.length, &publications,
+          &last_publication_time));
+  }
+
+  // the decoded file is handed over as a PublicationsFile
+  void HandleOKCallback()
+  {
+    NanScope();
+    Local<Object> pf = PublicationsFile::NewInstance(publications, last_publication_time);
+    publications = NULL;
+    Local<Value> argv[] = { NanNull(), NODE_UNIXTIME_V8(last_publication_time), pf };
+    callback->Call(3, argv);
+  }
+
+private:
+  GTPublicationsFile *publications;
+  double last_publication_time;
+};
+
+
+// State shared by the workers of one verifyBatch() call. Every worker
+// verifies a contiguous range of tokens; the last one to complete makes
+// the callback.
+class BatchContext
+{
+public:
+  size_t count;
+  BinaryInput *tokens;
+  BinaryInput *hashes;
+  const GTPublicationsFile *publications;
+  // set if publications was decoded for this batch only
+  GTPublicationsFile *own_publications;
+  int *results;
+  int remaining;
+  NanCallback *callback;
+
+  BatchContext(size_t count, Local<Object> inputs, NanCallback *callback)
+      : count(count), publications(NULL), own_publications(NULL), remaining(0), callback(callback)
+  {
+    tokens = new BinaryInput[count];
+    hashes = new BinaryInput[count];
+    results = new int[count];
+    NanAssignPersistent(this->inputs, inputs);
+  }
+
+  ~BatchContext()
+  {
+    NanDisposePersistent(inputs);
+    delete callback;
+    delete [] tokens;
+    delete [] hashes;
+    delete [] results;
+    if (own_publications != NULL)
+      GTPublicationsFile_free(own_publications);
+  }
+
+  // token statuses of tokens [begin, end): verification flags, or negated
+  // error code. With the bundled libgt the hash chains of a chunk of tokens
+  // are calculated together, see GTTimestamp_verifyMany().
+  void VerifyRange(size_t begin, size_t end)
+  {
+#ifdef PREINSTALLED_LIBGT
+    for (size_t i = begin; i < end; i++) {
+      int flags = 0;
+      int res = verify_one(tokens[i], hashes[i], &flags);
+      SetResult(i, res, flags);
+    }
+#else
+    const size_t chunk = 64;
+    GTTimestamp *timestamps[chunk];
+    GTVerificationInfo *infos[chunk];
+    int statuses[chunk];
+    size_t index[chunk];
+    for (size_t first = begin; first < end; first += chunk) {
+      size_t n = end - first < chunk ? end - first : chunk, decoded = 0;
+      for (size_t k = 0; k < n; k++) {
+        int res = GTTimestamp_DERDecode(tokens[first + k].data, tokens[first + k].length,
+            &timestamps[decoded]);
+        if (res != GT_OK) {
+          SetResult(first + k, res, 0);
+          continue;
+        }
+        index[decoded++] = first + k;
+      }
+      int res = GTTimestamp_verifyMany(decoded, timestamps, 0, infos, statuses);
+      for (size_t j = 0; j < decoded; j++) {
+        int flags = 0;
+        int status = res != GT_OK ? res : statuses[j];
+        if (status == GT_OK && infos[j]->verification_errors != GT_NO_FAILURES)
+          status = TS_VERIFICATION_FAILURE;
+        if (status == GT_OK)
+          status = check_document(timestamps[j], hashes[index[j]], infos[j], &flags);
+        SetResult(index[j], status, flags);
+        if (res == GT_OK)
+          GTVerificationInfo_free(infos[j]);
+        GTTimestamp_free(timestamps[j]);
+      }
+    }
+#endif
+  }
+
+private:
+  // keeps the input Buffers alive
+  Persistent<Object> inputs;
+
+  void SetResult(size_t i, int res, int flags)
+  {
+    // TS_VERIFICATION_FAILURE is negative already
+    results[i] = res == GT_OK ? flags : (res > 0 ? -res : res);
+  }
+
+#ifdef PREINSTALLED_LIBGT
+  int verify_one(const BinaryInput &token, const BinaryInput &hash, int *flags)
+  {
+    GTTimestamp *timestamp = NULL;
+    GTVerificationInfo *verification_info = NULL;
+    int res = GTTimestamp_DERDecode(token.data, token.length, &timestamp);
+    if (res != GT_OK)
+      goto cleanup;
+    res = TimeSignature::verify_timestamp(timestamp, 0, &verification_info);
+    if (res != GT_OK)
+      goto cleanup;
+    res = check_document(timestamp, hash, verification_info, flags);
+
+cleanup:
+    GTVerificationInfo_free(verification_info);
+    GTTimestamp_free(timestamp);
+    return res;
+  }
+#endif
+
+  // document hash and publication checks of a verified timestamp
+  int check_document(const GTTimestamp *timestamp, const BinaryInput &hash,
+      const GTVerificationInfo *verification_info, int *flags)
+  {
+    GTDataHash dh;
+    dh.context = NULL;
+    dh.digest = (unsigned char *) hash.data;
+    dh.digest_length = hash.length;
+    int res = GTTimestamp_getAlgorithm(timestamp, &dh.algorithm);
+    if (res != GT_OK)
+      return res;
+    res = GTTimestamp_checkDocumentHash(timestamp, &dh);
+    if (res != GT_OK)
+      return res;
+
+    res = TimeSignature::check_publication(timestamp, publications, verification_info);
+    if (res != GT_OK)
+      return res;
+    *flags = verification_info->verification_status |
+        GT_DOCUMENT_HASH_CHECKED | GT_PUBLICATION_CHECKED;
+    return GT_OK;
+  }
+};
+
+
+class BatchWorker : public NanAsyncWorker
+{
+public:
+  BatchWorker(BatchContext *context, size_t begin, size_t end)
+      : NanAsyncWorker(NULL), context(context), begin(begin), end(end)
+  {
+    context->remaining++;
+  }
+
+  void Execute()
+  {
+    context->VerifyRange(begin, end);
+  }
+
+  // runs on the main thread, thus no locking around 'remaining'
+  virtual void WorkComplete()
+  {
+    if (--context->remaining > 0)
+      return;
+    NanScope();
+    Local<Array> results = NanNew<Array>(context->count);
+    for (size_t i = 0; i < context->count; i++)
+      results->Set(i, NanNew<Integer>(context->results[i]));
+    Local<Value> argv[] = { NanNull(), results };
+    context->callback->Call(2, argv);
+    delete context;
+  }
+
+private:
+  BatchContext *context;
+  size_t begin, end;
+};
+
+
+// elements of an Array of tokens or hashes: Buffers or binary strings only
+static bool batch_element(BinaryInput *input, Handle<Value> val)
+{
+  if (!val->IsString() && !Buffer::HasInstance(val))
+    return false;
+  return input->Set(val);
+}
+
+// a copy of an Array given to verifyBatch(), kept with the call so that
+// its Buffers, referred to in place, stay alive even if the caller's Array
+// is modified while the batch runs
+static Local<Array> batch_array(Handle<Value> val)
+{
+  Local<Array> arr = val.As<Array>();
+  Local<Array> copy = NanNew<Array>(arr->Length());
+  for (uint32_t i = 0; i < arr->Length(); i++)
+    copy->Set(i, arr->Get(i));
+  return copy;
+}
+
+// splits concatenated DER tokens, or takes an Array of them
+static bool batch_tokens(BatchContext *context, Handle<Value> val)
+{
+  if (Buffer::HasInstance(val)) {
+    Local<Object> buffer_obj = val->ToObject();
+    char *data = Buffer::Data(buffer_obj);
+    size_t len = Buffer::Length(buffer_obj);
+    for (size_t i = 0; i < context->count; i++) {
+      size_t n = der_object_length((const unsigned char *) data, len);
+      if (n == 0)
+        return false;
+      context->tokens[i].Refer(data, n);
+      data += n;
+      len -= n;
+    }
+    return len == 0;
+  }
+  Local<Array> arr = val.As<Array>();
+  if (arr->Length() != context->count)
+    return false;
+  for (size_t i = 0; i < context->count; i++)
+    if (!batch_element(&context->tokens[i], arr->Get(i)))
+      return false;
+  return true;
+}
+
+// Array of digests, or equally sized digests packed into one Buffer
+static bool batch_hashes(BatchContext *context, Handle<Value> val)
+{
+  if (Buffer::HasInstance(val)) {
+    Local<Object> buffer_obj = val->ToObject();
+    char *data = Buffer::Data(buffer_obj);
+    size_t len = Buffer::Length(buffer_obj);
+    if (context->count == 0 || len % context->count != 0)
+      return context->count == 0 && len == 0;
+    size_t n = len / context->count;
+    for (size_t i = 0; i < context->count; i++)
+      context->hashes[i].Refer(data + i * n, n);
+    return true;
+  }
+  Local<Array> arr = val.As<Array>();
+  if (arr->Length() != context->count)
+    return false;
+  for (size_t i = 0; i < context->count; i++)
+    if (!batch_element(&context->hashes[i], arr->Get(i)))
+      return false;
+  return true;
+}
+
+// number of tokens in an Array or in concatenated DER tokens
+static bool batch_count(Handle<Value> val, size_t *count)
+{
+  if (val->IsArray()) {
+    *count = val.As<Array>()->Length();
+    return true;
+  }
+  Local<Object> buffer_obj = val->ToObject();
+  const unsigned char *data = (const unsigned char *) Buffer::Data(buffer_obj);
+  size_t len = Buffer::Length(buffer_obj);
+  *count = 0;
+  while (len > 0) {
+    size_t n = der_object_length(data, len);
+    if (n == 0)
+      return false;
+    data += n;
+    len -= n;
+    (*count)++;
+  }
+  return true;
+}
+
+static int cpu_count()
+{
+  uv_cpu_info_t *cpus = NULL;
+  int count = 0;
+  uv_cpu_info(&cpus, &count);
+  if (count > 0)
+    uv_free_cpu_info(cpus, count);
+  return count > 0 ? count : 1;
+}
+
+
+// TimeSignature.verifyBatch(tokens, hashes, publications, callback(err, statuses))
+// Verifies many tokens across the thread pool. Digests must be created with
+// the hash algorithm of respective token. Status of every token is either
+// the bitfield of performed checks or the negated libgt error code.
+NAN_METHOD(TimeSignature::VerifyBatch)
+{
+  NanScope();
+
+  ASSERT_IS_N_ARGS(4);
+  if (!args[0]->IsArray() && !Buffer::HasInstance(args[0])) {
+    return NanThrowTypeError("Tokens must be an Array or a Buffer");
+  }
+  if (!args[1]->IsArray() && !Buffer::HasInstance(args[1])) {
+    return NanThrowTypeError("Hashes must be an Array or a Buffer");
+  }
+  if (!PublicationsFile::HasInstance(args[2])) {
+    ASSERT_IS_STRING_OR_BUFFER(args[2]);
+  }
+  ASSERT_IS_CALLBACK(args[3]);
+
+  size_t count;
+  if (!batch_count(args[0], &count)) {
+    return NanThrowError("Invalid format of concatenated tokens");
+  }
+
+  Local<Value> tokens = args[0]->IsArray() ? Local<Value>(batch_array(args[0])) : args[0];
+  Local<Value> hashes = args[1]->IsArray() ? Local<Value>(batch_array(args[1])) : args[1];
+  Local<Object> inputs = NanNew<Object>();
+  inputs->Set(NanNew<String>("tokens"), tokens);
+  inputs->Set(NanNew<String>("hashes"), hashes);
+  inputs->Set(NanNew<String>("publications"), args[2]);
+  BatchContext *context = new BatchContext(count, inputs,
+      new NanCallback(args[3].As<Function>()));
+
+  if (!batch_tokens(context, tokens) || !batch_hashes(context, hashes)) {
+    delete context;
+    return NanThrowTypeError("Bad argument");
+  }
+  if (PublicationsFile::HasInstance(args[2])) {
+    context->publications = ObjectWrap::Unwrap<PublicationsFile>(args[2]->ToObject())->publications;
+  } else {
+    BinaryInput pubdata;
+    if (!pubdata.Set(args[2])) {
+      delete context;
+      return NanThrowTypeError("Bad argument");
+    }
+    int res = GTPublicationsFile_DERDecode(pubdata.data, pubdata.length, &context->own_publications);
+    if (res != GT_OK) {
+      delete context;
+      return NanThrowError(GT_getErrorString(res));
+    }
+    context->publications = context->own_publications;
+  }
+
+  size_t nworkers = cpu_count();
+  if (nworkers > count)
+    nworkers = count;
+  if (nworkers == 0)
+    nworkers = 1;
+  // all workers are created before queueing any, so that none can finish early
+  BatchWorker **workers = new BatchWorker*[nworkers];
+  for (size_t i = 0; i < nworkers; i++)
+    workers[i] = new BatchWorker(context, count * i / nworkers, count * (i + 1) / nworkers);
+  for (size_t i = 0; i < nworkers; i++)
+    NanAsyncQueueWorker(workers[i]);
+  delete [] workers;
+  NanReturnUndefined();
+}
+
+// ts.verifyAsync(callback(err, properties))
+NAN_METHOD(TimeSignature::VerifyAsync)
+{
+  NanScope();
+  UNWRAP_ts();
+
+  ASSERT_IS_N_ARGS(1);
+  ASSERT_IS_CALLBACK(args[0]);
+
+  NanCallback *callback = new NanCallback(args[0].As<Function>());
+  NanAsyncQueueWorker(new VerifyWorker(callback, args.This(), ts));
+  NanReturnUndefined();
+}
+
+// ts.verifyDocument(hash, algo, publications file, [no_extend], callback(err, properties, extend))
+// 'extend' is true if the timestamp should be extended and verified again;
+// with no_extend the publication check is done without.
+NAN_METHOD(TimeSignature::VerifyDocument)
+{
+  NanScope();
+  UNWRAP_ts();
+
+  if (args.Length() < 4 || args.Length() > 5) {
+    return NanThrowTypeError("Wrong number of arguments");
+  }
+  ASSERT_IS_STRING_OR_BUFFER(args[0]);
+  if (!args[1]->IsString()) {
+    return NanThrowTypeError("2nd argument must be hash type as string");
+  }
+  if (!PublicationsFile::HasInstance(args[2])) {
+    return NanThrowTypeError("3rd argument must be a PublicationsFile");
+  }
+  ASSERT_IS_CALLBACK(args[args.Length() - 1]);
+
+  int hashalg_gt_id = getAlgoID(*String::Utf8Value(args[1]->ToString()));
+  if (hashalg_gt_id < 0) {
+    return NanThrowError("Unsupported hash algorithm");
+  }
+  bool no_extend = args.Length() == 5 && args[3]->BooleanValue();
+
+  NanCallback *callback = new NanCallback(args[args.Length() - 1].As<Function>());
+  DocumentWorker *worker = new DocumentWorker(callback, args.This(), ts, hashalg_gt_id,
+      args[2]->ToObject(), no_extend);
+  if (!worker->SetInput(args[0])) {
+    delete worker;
+    return NanThrowTypeError("Bad argument");
+  }
+  NanAsyncQueueWorker(worker);
+  NanReturnUndefined();
+}
+
+// ts.verifyAggregated(hash, algo, chain, publications file, [no_extend], callback(err, properties, extend))
+// like verifyDocument(), the hash having been signed with aggregate() and
+// 'chain' linking it to the signed root
+NAN_METHOD(TimeSignature::VerifyAggregated)
+{
+  NanScope();
+  UNWRAP_ts();
+
+  if (args.Length() < 5 || args.Length() > 6) {
+    return NanThrowTypeError("Wrong number of arguments");
+  }
+  ASSERT_IS_STRING_OR_BUFFER(args[0]);
+  if (!args[1]->IsString()) {
+    return NanThrowTypeError("2nd argument must be hash type as string");
+  }
+  ASSERT_IS_STRING_OR_BUFFER(args[2]);
+  if (!PublicationsFile::HasInstance(args[3])) {
+    return NanThrowTypeError("4th argument must be a PublicationsFile");
+  }
+  ASSERT_IS_CALLBACK(args[args.Length() - 1]);
+#ifdef PREINSTALLED_LIBGT
+  return NanThrowError("Aggregation is not supported with preinstalled libgt");
+#else
+  int hashalg_gt_id = getAlgoID(*String::Utf8Value(args[1]->ToString()));
+  if (hashalg_gt_id < 0) {
+    return NanThrowError("Unsupported hash algorithm");
+  }
+  DECODE_BINARY(hash, args[0]);
+  if (hash.length != GT_getHashSize(hashalg_gt_id)) {
+    return NanThrowTypeError("Hash length does not match the algorithm");
+  }
+  bool no_extend = args.Length() == 6 && args[4]->BooleanValue();
+
+  NanCallback *callback = new NanCallback(args[args.Length() - 1].As<Function>());
+  DocumentWorker *worker = new DocumentWorker(callback, args.This(), ts, hashalg_gt_id,
+      args[3]->ToObject(), no_extend);
+  if (!worker->SetInput(args[0]) || !worker->SetChain(args[2])) {
+    delete worker;
+    return NanThrowTypeError("Bad argument");
+  }
+  NanAsyncQueueWorker(worker);
+  NanReturnUndefined();
+#endif
+}
+
+// ts.compareHashAsync(hash, [algo], callback(err, flag))
+NAN_METHOD(TimeSignature::CompareHashAsync)
+{
+  NanScope();
+  UNWRAP_ts();
+
+  if (args.Length() < 2 || args.Length() > 3) {
+    return NanThrowTypeError("Wrong number of parameters");
+  }
+  ASSERT_IS_STRING_OR_BUFFER(args[0]);
+  ASSERT_IS_CALLBACK(args[args.Length() - 1]);
+
+  if (args.Length() == 3 && !args[1]->IsString()) {
+    return NanThrowTypeError("Optional 2nd argument must be hash type as string");
+  }
+  int hashalg_gt_id = 1;
+  if (args.Length() == 3)
+    hashalg_gt_id = getAlgoID(*String::Utf8Value(args[1]->ToString()));
+  if (hashalg_gt_id < 0) {
+    return NanThrowError("Unsupported hash algorithm");
+  }
+
+  NanCallback *callback = new NanCallback(args[args.Length() - 1].As<Function>());
+  CompareHashWorker *worker = new CompareHashWorker(callback, args.This(), ts, hashalg_gt_id);
+  if (!worker->SetInput(args[0])) {
+    delete worker;
+    return NanThrowTypeError("Bad argument");
+  }
+  NanAsyncQueueWorker(worker);
+  NanReturnUndefined();
+}
+
+// ts.checkPublicationAsync(pub. file content, callback(err, flag))
+NAN_METHOD(TimeSignature::CheckPublicationAsync)
+{
+  NanScope();
+  UNWRAP_ts();
+
+  ASSERT_IS_N_ARGS(2);
+  ASSERT_IS_CALLBACK(args[1]);
+  bool decoded = PublicationsFile::HasInstance(args[0]);
+  if (!decoded && !BinaryInput::IsBinary(args[0])) {
+    return NanThrowTypeError("Not a string or buffer");
+  }
+
+  NanCallback *callback = new NanCallback(args[1].As<Function>());
+  CheckPublicationWorker *worker = new CheckPublicationWorker(callback, args.This(), ts);
+  if (decoded) {
+    worker->SetPublications(args[0]->ToObject());
+    NanAsyncQueueWorker(worker);
+    NanReturnUndefined();
+  }
+  if (!worker->SetInput(args[0])) {
+    delete worker;
+    return NanThrowTypeError("Bad argument");
+  }
+  NanAsyncQueueWorker(worker);
+  NanReturnUndefined();
+}
+
+// ts.extendAsync(extending response, callback(err, true or status code))
+NAN_METHOD(TimeSignature::ExtendAsync)
+{
+  NanScope();
+  UNWRAP_ts();
+  ASSERT_NOT_BUSY(ts);
+
+  ASSERT_IS_N_ARGS(2);
+  ASSERT_IS_STRING_OR_BUFFER(args[0]);
+  ASSERT_IS_CALLBACK(args[1]);
+
+  NanCallback *callback = new NanCallback(args[1].As<Function>());
+  ExtendWorker *worker = new ExtendWorker(callback, args.This(), ts);
+  if (!worker->SetInput(args[0])) {
+    delete worker;
+    return NanThrowTypeError("Bad argument");
+  }
+  NanAsyncQueueWorker(worker);
+  NanReturnUndefined();
+}
+
+// TimeSignature.processResponseAsync(response, callback(err, der_token))
+NAN_METHOD(TimeSignature::ProcessResponseAsync)
+{
+  NanScope();
+
+  ASSERT_IS_N_ARGS(2);
+  ASSERT_IS_STRING_OR_BUFFER(args[0]);
+  ASSERT_IS_CALLBACK(args[1]);
+
+  NanCallback *callback = new NanCallback(args[1].As<Function>());
+  ProcessResponseWorker *worker = new ProcessResponseWorker(callback);
+  if (!worker->SetInput(args[0])) {
+    delete worker;
+    return NanThrowTypeError("Bad argument");
+  }
+  NanAsyncQueueWorker(worker);
+  NanReturnUndefined();
+}
+
+// TimeSignature.fromResponseAsync(response, callback(err, timesignature))
+NAN_METHOD(TimeSignature::FromResponseAsync)
+{
+  NanScope();
+
+  ASSERT_IS_N_ARGS(2);
+  ASSERT_IS_STRING_OR_BUFFER(args[0]);
+  ASSERT_IS_CALLBACK(args[1]);
+
+  NanCallback *callback = new NanCallback(args[1].As<Function>());
+  FromResponseWorker *worker = new FromResponseWorker(callback);
+  if (!worker->SetInput(args[0])) {
+    delete worker;
+    return NanThrowTypeError("Bad argument");
+  }
+  NanAsyncQueueWorker(worker);
+  NanReturnUndefined();
+}
+
+// TimeSignature.hashFile(path, [algo], callback(err, digest))
+// hashes the file in the thread pool with large sequential reads
+NAN_METHOD(TimeSignature::HashFile)
+{
+  NanScope();
+
+  if (args.Length() < 2 || args.Length() > 3) {
+    return NanThrowTypeError("Wrong number of arguments");
+  }
+  if (!args[0]->IsString()) {
+    return NanThrowTypeError("1st argument must be file name as string");
+  }
+  if (args.Length() == 3 && !args[1]->IsString()) {
+    return NanThrowTypeError("Optional 2nd argument must be hash algorithm name as string");
+  }
+  ASSERT_IS_CALLBACK(args[args.Length() - 1]);
+
+  int hashalg_gt_id = 1;
+  if (args.Length() == 3)
+    hashalg_gt_id = getAlgoID(*String::Utf8Value(args[1]->ToString()));
+  if (hashalg_gt_id < 0) {
+    return NanThrowTypeError("Unsupported hash algorithm");
+  }
+
+  NanCallback *callback = new NanCallback(args[args.Length() - 1].As<Function>());
+  NanAsyncQueueWorker(new HashFileWorker(callback,
+      *String::Utf8Value(args[0]->ToString()), hashalg_gt_id));
+  NanReturnUndefined();
+}
+
+// TimeSignature.verifyPublicationsAsync(pub. file content, callback(err, last_pub_date))
+NAN_METHOD(TimeSignature::VerifyPublicationsAsync)
+{
+  NanScope();
+
+  ASSERT_IS_N_ARGS(2);
+  ASSERT_IS_STRING_OR_BUFFER(args[0]);
+  ASSERT_IS_CALLBACK(args[1]);
+
+  NanCallback *callback = new NanCallback(args[1].As<Function>());
+  VerifyPublicationsWorker *worker = new VerifyPublicationsWorker(callback);
+  if (!worker->SetInput(args[0])) {
+    delete worker;
+    return NanThrowTypeError("Bad argument");
+  }
+  NanAsyncQueueWorker(worker);
+  NanReturnUndefined();
+}
 extern "C" {
   void init (Handle<Object> target)
   {
@@ -700,7 +2529,9 @@ extern "C" {
                            NanNew<String>(GT_getErrorString(res))));
       return;
     }
+    VerificationResult::Init();
     TimeSignature::Init(target);
+    PublicationsFile::Init(target);
 
     // If system certificate stores not detected then use Node's root certificates to
     // validate signature on publications file.